@@ -22,10 +22,21 @@ typedef struct _GKGameBoyAdapter {
 	float crank_previous;
 	int selected_scale;
 	int save_timer;
+	unsigned int rtc_timer;
 
 	bool clear_next_frame;
 } GKGameBoyAdapter;
 
+// Have the emulator dither lines into the frame as it draws them, rather than
+// dithering changed lines afterwards. The whole screen is still redrawn with
+// update_display_*().
+#define GK_PPU_DITHER 1
+
+// Titles of ROMs that misbehave when idle loops are skipped.
+static const char* const GKNoIdleSkipTitles[] = {
+	NULL
+};
+
 #pragma mark -
 
 static void update_joypad(GKGameBoyAdapter* adapter);
@@ -35,6 +46,7 @@ static void free_menus(GKGameBoyAdapter* adapter);
 static void reset(GKGameBoyAdapter* adapter);
 static void save(GKGameBoyAdapter* adapter);
 static void load_save(const char* save_file_name, uint8_t** dest, const size_t len);
+static bool allows_idle_skip(struct gb_s* gb);
 static uint8_t read_rom_byte(struct gb_s* gb, const uint_fast32_t addr);
 static uint8_t read_ram_byte(struct gb_s* gb, const uint_fast32_t addr);
 static void write_ram_byte(struct gb_s* gb, const uint_fast32_t addr, const uint8_t val);
@@ -42,6 +54,8 @@ static void error(struct gb_s* gb, const enum gb_error_e gb_err, const uint16_t
 static void update_display_natural(GKGameBoyAdapter* adapter);
 static void update_display_doubled(GKGameBoyAdapter* adapter);
 static void update_display_fitted(GKGameBoyAdapter* adapter);
+static void update_dither(GKGameBoyAdapter* adapter);
+static void mark_dithered_rows(GKGameBoyAdapter* adapter);
 
 #pragma mark -
 
@@ -69,7 +83,6 @@ void GKGameBoyAdapterDestroy(GKGameBoyAdapter* adapter) {
 }
 
 bool GKGameBoyAdapterLoad(GKGameBoyAdapter* adapter, const char* path) {
-	memset(&adapter->gb, 0, sizeof(struct gb_s));
 	adapter->clear_next_frame = true;
 	
 	enum gb_init_error_e gb_ret;
@@ -81,6 +94,7 @@ bool GKGameBoyAdapterLoad(GKGameBoyAdapter* adapter, const char* path) {
 	// Save and free resources if we have loaded a game previously.
 	save(adapter);
 	reset(adapter);
+	memset(&adapter->gb, 0, sizeof(struct gb_s));
 	
 	// Read ROM into memory.
 	if((adapter->rom = GKReadFileContents(path, NULL)) == NULL) {
@@ -124,24 +138,33 @@ bool GKGameBoyAdapterLoad(GKGameBoyAdapter* adapter, const char* path) {
 		GKLog("Invalid ROM: Checksum failure.");
 		return false;
 	
+	case GB_INIT_OUT_OF_MEMORY:
+		GKLog("Out of memory.");
+		return false;
+	
 	default:
 		GKLog("Unknown error: %d\n", gb_ret);
 		return false;
 	}
 	
+	// The whole ROM is in memory, so let the emulator read it directly.
+	gb_set_rom(&adapter->gb, adapter->rom);
+
 	// Load save file.
 	load_save(adapter->save_file_name, &adapter->cart_ram, gb_get_save_size(&adapter->gb));
+	gb_set_cart_ram(&adapter->gb, adapter->cart_ram);
 
 	// Initialize display.
 	gb_init_lcd(&adapter->gb, NULL);
 	adapter->gb.direct.frame_skip = 1;
 	adapter->gb.direct.joypad = 255;
+	adapter->gb.direct.idle_skip = allows_idle_skip(&adapter->gb);
 	
 	// Initialize sound.
 	if(GKAppGetSoundEnabled()) {
-		audio_init();
+		audio_init(&adapter->gb.apu);
 		playdate->sound->channel->setVolume(playdate->sound->getDefaultChannel(), 0.2f);
-		adapter->sound_source = playdate->sound->addSource(GKAudioSourceCallback, NULL, 1);
+		adapter->sound_source = playdate->sound->addSource(GKAudioSourceCallback, &adapter->gb.apu, 1);
 		adapter->gb.direct.sound_enabled = 1;
 	}
 
@@ -153,7 +176,6 @@ bool GKGameBoyAdapterLoad(GKGameBoyAdapter* adapter, const char* path) {
 }
 
 void GKGameBoyAdapterUpdate(GKGameBoyAdapter* adapter, unsigned int dt) {
-	static unsigned int rtc_timer = 0;
 	unsigned int fast_mode = 1;
 	bool force_update = adapter->clear_next_frame;
 	// const double target_speed_ms = 1000.0 / (VERTICAL_SYNC);
@@ -168,18 +190,25 @@ void GKGameBoyAdapterUpdate(GKGameBoyAdapter* adapter, unsigned int dt) {
 	playdate->graphics->setDrawMode(kDrawModeCopy);
 	adapter->current_frame = (uint32_t*)playdate->graphics->getFrame();
 	
+	if(GK_PPU_DITHER && force_update) {
+		update_dither(adapter);
+	}
+	
 	update_joypad(adapter);
 	update_crank(adapter);
 	
 	gb_run_frame(&adapter->gb);
 	
 	if(force_update) {
-		memset(adapter->gb.display.changed_rows, 1, sizeof(adapter->gb.display.changed_rows));
+		memset(adapter->gb.display.changed_rows, 0xFF, sizeof(adapter->gb.display.changed_rows));
 		adapter->gb.display.changed_row_count = LCD_HEIGHT;
 	}
 	
 	if(force_update || (adapter->gb.display.changed_row_count > 0 && (!adapter->gb.direct.frame_skip || !adapter->gb.display.frame_skip_count))) {
-		if(adapter->selected_scale == 0) {
+		if(!force_update && adapter->gb.display.dither.frame != NULL) {
+			mark_dithered_rows(adapter);
+		}
+		else if(adapter->selected_scale == 0) {
 			update_display_natural(adapter);
 		}
 		else if(adapter->selected_scale == 1) {
@@ -191,9 +220,9 @@ void GKGameBoyAdapterUpdate(GKGameBoyAdapter* adapter, unsigned int dt) {
 	}
 	
 	// Tick the internal RTC every 1 second.
-	rtc_timer += dt;// target_speed_ms / fast_mode;
-	if(rtc_timer >= 1000) {
-		rtc_timer -= 1000;
+	adapter->rtc_timer += dt;// target_speed_ms / fast_mode;
+	if(adapter->rtc_timer >= 1000) {
+		adapter->rtc_timer -= 1000;
 		gb_tick_rtc(&adapter->gb);
 	}
 	
@@ -297,11 +326,12 @@ static void reset(GKGameBoyAdapter* adapter) {
 		adapter->save_file_name = NULL;
 	}
 	
-	gb_reset(&adapter->gb);
+	gb_free(&adapter->gb);
 	
 	adapter->crank_previous = playdate->system->getCrankAngle();
 	adapter->clear_next_frame = true;
 	adapter->save_timer = 0;
+	adapter->rtc_timer = 0;
 }
 
 static void save(GKGameBoyAdapter* adapter) {
@@ -312,7 +342,7 @@ static void save(GKGameBoyAdapter* adapter) {
 	int ram_length = gb_get_save_size(&adapter->gb);
 	
 	// Make sure there is something to save.
-	if(ram_length == 0) {
+	if(ram_length == 0 || !gb_cart_ram_modified(&adapter->gb)) {
 		return;
 	}
 	
@@ -321,8 +351,16 @@ static void save(GKGameBoyAdapter* adapter) {
 		GKLog("Gamekid: Unable to open save file at %s.", adapter->save_file_name);
 		return;
 	}
-	GKFileWrite(adapter->cart_ram, ram_length, f);
-	GKFileClose(f);
+	
+	// Keep the RAM marked as modified if it could not be saved, so that the
+	// next save tries again.
+	const bool written = GKFileWrite(adapter->cart_ram, ram_length, f) == ram_length;
+	if(GKFileClose(f) != 0 || !written) {
+		GKLog("Gamekid: Unable to write save file at %s.", adapter->save_file_name);
+		return;
+	}
+	
+	gb_cart_ram_clear_modified(&adapter->gb);
 }
 
 static void load_save(const char* save_file_name, uint8_t** dest, const size_t len) {
@@ -344,7 +382,8 @@ static void load_save(const char* save_file_name, uint8_t** dest, const size_t l
 	f = GKFileOpen(save_file_name, kGKFileReadData);
 	
 	/* It doesn't matter if the save file doesn't exist. We initialise the
-	* save memory allocated above. The save file will be created on exit. */
+	* save memory allocated above. The save file will be created the first
+	* time the game writes to cart RAM. */
 	if(f == NULL) {
 		GKLog("Failed to open save file");
 		memset(*dest, 0xFF, len);
@@ -356,6 +395,19 @@ static void load_save(const char* save_file_name, uint8_t** dest, const size_t l
 	GKFileClose(f);
 }
 
+static bool allows_idle_skip(struct gb_s* gb) {
+	char title[17];
+	gb_get_rom_name(gb, title);
+	
+	for(int i = 0; GKNoIdleSkipTitles[i] != NULL; i++) {
+		if(strcmp(title, GKNoIdleSkipTitles[i]) == 0) {
+			return false;
+		}
+	}
+	
+	return true;
+}
+
 #pragma mark -
 
 static uint8_t read_rom_byte(struct gb_s* gb, const uint_fast32_t addr) {
@@ -442,25 +494,25 @@ static void update_display_natural(GKGameBoyAdapter* adapter) {
 	uint32_t* frame = NULL;
 	
 	for(uint32_t line = 0; line < LCD_HEIGHT; line++) {
-		if(adapter->gb.display.changed_rows[line] == 0) {
+		if(!gb_line_changed(&adapter->gb, line)) {
 			continue;
 		}
 		
 		frame = adapter->current_frame + (((LCD_ROWSIZE / 4) * (start_y + line))) + 3;
-		const uint8_t* const pixels = !adapter->gb.display.back_fb_enabled ? adapter->gb.display.back_fb[line] : adapter->gb.display.front_fb[line];
+		const uint8_t* const pixels = adapter->gb.display.fb[line];
 	
 		uint32_t accumulator = 0x00000000;
 		const uint32_t line_mod = GKFastMod4(line);
 		
 		// Handle first 8 bits of row.
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[0] & 0x3][line_mod][0], 7, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[1] & 0x3][line_mod][1], 6, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[2] & 0x3][line_mod][2], 5, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[3] & 0x3][line_mod][3], 4, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[4] & 0x3][line_mod][0], 3, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[5] & 0x3][line_mod][1], 2, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[6] & 0x3][line_mod][2], 1, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[7] & 0x3][line_mod][3], 0, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 0)][line_mod][0], 7, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 1)][line_mod][1], 6, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 2)][line_mod][2], 5, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 3)][line_mod][3], 4, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 4)][line_mod][0], 3, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 5)][line_mod][1], 2, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 6)][line_mod][2], 1, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 7)][line_mod][3], 0, accumulator);
 		*frame = swap(accumulator);
 		frame++;
 		accumulator = 0x00000000;
@@ -468,73 +520,73 @@ static void update_display_natural(GKGameBoyAdapter* adapter) {
 		uint32_t x = 8;
 		
 		for(uint32_t i = 0; i < 4; i++) {
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 31, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 30, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 29, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 28, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 27, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 26, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 25, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 24, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 31, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 30, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 29, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 28, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 27, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 26, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 25, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 24, accumulator);
 			
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 23, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 22, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 21, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 20, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 19, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 18, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 17, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 16, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 23, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 22, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 21, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 20, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 19, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 18, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 17, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 16, accumulator);
 		
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 15, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 14, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 13, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 12, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 11, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 10, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 9, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 8, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 15, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 14, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 13, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 12, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 11, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 10, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 9, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 8, accumulator);
 			
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 7, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 6, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 5, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 4, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][0], 3, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][1], 2, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][2], 1, accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[x++] & 0x3][line_mod][3], 0, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 7, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 6, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 5, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 4, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][0], 3, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][1], 2, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][2], 1, accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, x++)][line_mod][3], 0, accumulator);
 		
 			*frame = swap(accumulator);
 			frame++;
 			accumulator = 0x00000000;
 		}
 		
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[136] & 0x3][line_mod][0], 31, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[137] & 0x3][line_mod][1], 30, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[138] & 0x3][line_mod][2], 29, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[139] & 0x3][line_mod][3], 28, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[140] & 0x3][line_mod][0], 27, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[141] & 0x3][line_mod][1], 26, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[142] & 0x3][line_mod][2], 25, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[143] & 0x3][line_mod][3], 24, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 136)][line_mod][0], 31, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 137)][line_mod][1], 30, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 138)][line_mod][2], 29, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 139)][line_mod][3], 28, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 140)][line_mod][0], 27, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 141)][line_mod][1], 26, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 142)][line_mod][2], 25, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 143)][line_mod][3], 24, accumulator);
 		
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[144] & 0x3][line_mod][0], 23, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[145] & 0x3][line_mod][1], 22, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[146] & 0x3][line_mod][2], 21, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[147] & 0x3][line_mod][3], 20, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[148] & 0x3][line_mod][0], 19, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[149] & 0x3][line_mod][1], 18, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[150] & 0x3][line_mod][2], 17, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[151] & 0x3][line_mod][3], 16, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 144)][line_mod][0], 23, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 145)][line_mod][1], 22, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 146)][line_mod][2], 21, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 147)][line_mod][3], 20, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 148)][line_mod][0], 19, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 149)][line_mod][1], 18, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 150)][line_mod][2], 17, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 151)][line_mod][3], 16, accumulator);
 		
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[152] & 0x3][line_mod][0], 15, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[153] & 0x3][line_mod][1], 14, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[154] & 0x3][line_mod][2], 13, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[155] & 0x3][line_mod][3], 12, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[156] & 0x3][line_mod][0], 11, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[157] & 0x3][line_mod][1], 10, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[158] & 0x3][line_mod][2], 9, accumulator);
-		GKSetOrClearBitIf(GKDisplayPatterns[pixels[159] & 0x3][line_mod][3], 8, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 152)][line_mod][0], 15, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 153)][line_mod][1], 14, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 154)][line_mod][2], 13, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 155)][line_mod][3], 12, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 156)][line_mod][0], 11, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 157)][line_mod][1], 10, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 158)][line_mod][2], 9, accumulator);
+		GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, 159)][line_mod][3], 8, accumulator);
 		*frame = swap(accumulator);
 		
 		playdate->graphics->markUpdatedRows(start_y + line, start_y + line);
@@ -552,7 +604,7 @@ static void update_display_doubled(GKGameBoyAdapter* adapter) {
 	uint32_t bit;
 	
 	for(uint32_t line = 12; line < LCD_HEIGHT - 12; line++) {
-		if(adapter->gb.display.changed_rows[line] == 0) {
+		if(!gb_line_changed(&adapter->gb, line)) {
 			continue;
 		}
 		
@@ -561,7 +613,7 @@ static void update_display_doubled(GKGameBoyAdapter* adapter) {
 			break;
 		}
 		
-		const uint8_t* const pixels = !adapter->gb.display.back_fb_enabled ? adapter->gb.display.back_fb[line] : adapter->gb.display.front_fb[line];
+		const uint8_t* const pixels = adapter->gb.display.fb[line];
 		
 		frame = display_frame + ((GKFastDiv4(LCD_ROWSIZE) * screen_y)) + GKFastDiv32(screen_x);
 		accumulator = swap(*frame);
@@ -569,7 +621,7 @@ static void update_display_doubled(GKGameBoyAdapter* adapter) {
 		for(uint32_t y = screen_y; y <= GKMin(screen_y + 1, LCD_ROWS); y++) {
 			for(uint32_t x = start_x; x < (LCD_WIDTH * 2) + start_x; x++) {
 				bit = 31 - GKFastMod32(x);
-				GKSetOrClearBitIf(GKDisplayPatterns[pixels[GKFastDiv2(x - start_x)] & 3][GKFastMod4(y)][GKFastMod4(x)], bit, accumulator);
+				GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, GKFastDiv2(x - start_x))][GKFastMod4(y)][GKFastMod4(x)], bit, accumulator);
 				if(bit == 0) {
 					*frame = swap(accumulator);
 					frame++;
@@ -592,11 +644,11 @@ static void update_display_fitted(GKGameBoyAdapter* adapter) {
 	uint32_t* display_frame = (uint32_t*)playdate->graphics->getFrame();
 	
 	for(uint32_t line = 0; line < LCD_HEIGHT; line++) {
-		if(adapter->gb.display.changed_rows[line] == 0) {
+		if(!gb_line_changed(&adapter->gb, line)) {
 			continue;
 		}
 		
-		const uint8_t* const pixels = !adapter->gb.display.back_fb_enabled ? adapter->gb.display.back_fb[line] : adapter->gb.display.front_fb[line];
+		const uint8_t* const pixels = adapter->gb.display.fb[line];
 		
 		const uint32_t double_line = GKFastMult2(line);
 		
@@ -627,8 +679,8 @@ static void update_display_fitted(GKGameBoyAdapter* adapter) {
 		uint32_t bit;
 		for(uint32_t x = start_x; x < GKFastMult2(LCD_WIDTH) + start_x; x++) {
 			bit = 31 - GKFastMod32(x);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[GKFastDiv2(x - start_x)] & 3][line_one_mod][GKFastMod4(x)], bit, line_one_accumulator);
-			GKSetOrClearBitIf(GKDisplayPatterns[pixels[GKFastDiv2(x - start_x)] & 3][line_two_mod][GKFastMod4(x)], bit, line_two_accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, GKFastDiv2(x - start_x))][line_one_mod][GKFastMod4(x)], bit, line_one_accumulator);
+			GKSetOrClearBitIf(GKDisplayPatterns[gb_fb_pixel(pixels, GKFastDiv2(x - start_x))][line_two_mod][GKFastMod4(x)], bit, line_two_accumulator);
 			if(bit == 0) {
 				if(line_one != NULL) {
 					*line_one = swap(line_one_accumulator);
@@ -652,4 +704,63 @@ static void update_display_fitted(GKGameBoyAdapter* adapter) {
 		playdate->graphics->markUpdatedRows(line_one_sy, line_one_sy+1);
 	}
 	
-}
\ No newline at end of file
+}
+
+// The same layout and patterns as update_display_*(), for the emulator to
+// dither with.
+static void update_dither(GKGameBoyAdapter* adapter) {
+	uint8_t rows[LCD_HEIGHT][2];
+	uint8_t patterns[4][4];
+	uint_fast8_t x;
+	uint_fast8_t scale;
+	
+	for(uint32_t shade = 0; shade < 4; shade++) {
+		for(uint32_t y = 0; y < 4; y++) {
+			patterns[shade][y] = (GKDisplayPatterns[shade][y][0] << 3) | (GKDisplayPatterns[shade][y][1] << 2) | (GKDisplayPatterns[shade][y][2] << 1) | GKDisplayPatterns[shade][y][3];
+		}
+	}
+	
+	for(uint32_t line = 0; line < LCD_HEIGHT; line++) {
+		if(adapter->selected_scale == 0) {
+			rows[line][0] = 48 + line;
+			rows[line][1] = GB_DITHER_NO_ROW;
+		}
+		else if(adapter->selected_scale == 1) {
+			// Screen Y is doubled then we remove every 6th line.
+			const uint32_t double_line = GKFastMult2(line);
+			rows[line][0] = double_line - double_line / 6;
+			rows[line][1] = ((double_line + 1) % 6 == 5) ? GB_DITHER_NO_ROW : rows[line][0] + 1;
+		}
+		else if(line >= 12 && line < LCD_HEIGHT - 12) {
+			rows[line][0] = GKFastMult2(line - 12);
+			rows[line][1] = rows[line][0] + 1;
+		}
+		else {
+			rows[line][0] = GB_DITHER_NO_ROW;
+			rows[line][1] = GB_DITHER_NO_ROW;
+		}
+	}
+	
+	if(adapter->selected_scale == 0) {
+		// Natural starts at pixel 120.
+		x = GKFastDiv8(120);
+		scale = 1;
+	}
+	else {
+		x = GKFastDiv8(GKFastDiv2(LCD_COLUMNS - GKFastMult2(LCD_WIDTH)));
+		scale = 2;
+	}
+	
+	gb_set_dither(&adapter->gb, (uint8_t*)adapter->current_frame, LCD_ROWSIZE, x, scale, (const uint8_t (*)[2])rows, (const uint8_t (*)[4])patterns);
+}
+
+static void mark_dithered_rows(GKGameBoyAdapter* adapter) {
+	for(uint32_t line = 0; line < LCD_HEIGHT; line++) {
+		if(!gb_line_changed(&adapter->gb, line) || adapter->gb.display.dither.rows[line][0] == GB_DITHER_NO_ROW) {
+			continue;
+		}
+		
+		const uint8_t* const rows = adapter->gb.display.dither.rows[line];
+		playdate->graphics->markUpdatedRows(rows[0], rows[1] == GB_DITHER_NO_ROW ? rows[0] : rows[1]);
+	}
+}
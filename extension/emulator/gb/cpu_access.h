@@ -1,39 +1,67 @@
-#if 0
-static uint8_t $A;
-static uint32_t $Z;
-static uint32_t $NH;
-static uint32_t $CR;
-static uint16_t $PC;
+/* Emulated CPU registers. With PEANUT_GB_PINNED_REGS, as many as possible are
+ * held in callee-saved host registers for as long as __gb_run_cpu() runs, so
+ * that calls out to __gb_read() and __gb_write() preserve them. Registers that
+ * do not fit are accessed through the struct. */
+#if !PEANUT_GB_PINNED_REGS
+#define $A  regs->a
+#define $NH regs->nh
+#define $Z  regs->z
+#define $CR regs->cr
+#define $PC regs->pc
+#define $BC regs->bc
+#define $DE regs->de
+#define $HL regs->hl
+#define $SP regs->sp
+#define PINNED_BC_DE 0
+#define PINNED_HL 0
 #elif defined(__arm__)
+/* Must be in ascending order, for ldm and stm. */
+#define R_BC "r4"
 #define R_A "r5"
 #define R_NH "r6"
 #define R_Z "r7"
 #define R_CR "r8"
 #define R_PC "r9"
+#define R_DE "r10"
+#define R_HL "r11"
+register uint16_t $BC asm("r4");
 register uint8_t  $A  asm("r5");
 register uint32_t $NH asm("r6");
 register uint32_t $Z  asm("r7");
 register uint32_t $CR asm("r8");
 register uint16_t $PC asm("r9");
-//register uint16_t BC asm("r6");
-//register uint16_t DE asm("r7");
-//register uint16_t F asm("r8");
-//register uint16_t Z  asm("r9");
-//register uint16_t NH asm("r10");
-//register uint16_t SP asm("r11");
+register uint16_t $DE asm("r10");
+register uint16_t $HL asm("r11");
+#define $SP regs->sp
+#define PINNED_BC_DE 1
+#define PINNED_HL 1
 #else
+/* rbp is left alone, as it is needed as the frame pointer in unoptimised
+ * builds. */
 register uint8_t  $A  asm("bl");
 register uint32_t $NH asm("r12");
 register uint32_t $Z  asm("r13");
 register uint32_t $CR asm("r14");
 register uint16_t $PC asm("r15");
-//register uint16_t BC asm("r9d");
-//register uint16_t DE asm("r10d");
-//register uint16_t F asm("r11d");
-//register uint16_t Z  asm("r12d");
-//register uint16_t SP asm("r14d");
+#define $BC regs->bc
+#define $DE regs->de
+#define $HL regs->hl
+#define $SP regs->sp
+#define PINNED_BC_DE 0
+#define PINNED_HL 0
 #endif
 
+/* A pinned register pair can only be accessed as a whole. */
+#if PINNED_BC_DE
+#define SET_REG_B(x) $BC = ((x) << 8) | ($BC & 0x00FF);
+#define GET_REG_B(x) (($BC) >> 8)
+#define SET_REG_C(x) $BC = ((x) & 0xFF) | ($BC & 0xFF00);
+#define GET_REG_C(x) (($BC) & 0xFF)
+#define SET_REG_D(x) $DE = ((x) << 8) | ($DE & 0x00FF);
+#define GET_REG_D(x) (($DE) >> 8)
+#define SET_REG_E(x) $DE = ((x) & 0xFF) | ($DE & 0xFF00);
+#define GET_REG_E(x) (($DE) & 0xFF)
+#else
 #define SET_REG_B(x) regs->b = (x);
 #define GET_REG_B(x) (regs->b)
 #define SET_REG_C(x) regs->c = (x);
@@ -42,59 +70,136 @@ register uint16_t $PC asm("r15");
 #define GET_REG_D(x) (regs->d)
 #define SET_REG_E(x) regs->e = (x);
 #define GET_REG_E(x) (regs->e)
+#endif
+#if PINNED_HL
 #define SET_REG_H(x) $HL = ((x) << 8) | ($HL & 0x00FF);
 #define GET_REG_H(x) (($HL) >> 8)
 #define SET_REG_L(x) $HL = ((x) & 0xFF) | ($HL & 0xFF00);
 #define GET_REG_L(x) (($HL) & 0xFF)
-#define SET_REGF_Z(x) $Z = (x);
-#define GET_REGF_Z() ($Z)
-#define SET_REGF_N(x) $NH = ($NH & ~1) | (x);
-#define GET_REGF_N() ($NH & 1)
+#else
+#define SET_REG_H(x) regs->h = (x);
+#define GET_REG_H(x) (regs->h)
+#define SET_REG_L(x) regs->l = (x);
+#define GET_REG_L(x) (regs->l)
+#endif
+/* Flags are evaluated lazily, from values recorded by the last instruction
+ * that set them:
+ *  $Z  - a result; Z is set when its low byte is zero.
+ *  $NH - operand ^ operand ^ result; H is bit 4. N is bit 16.
+ *  $CR - a result; C is bit 8.
+ * SET_REGF_* set a single flag from a boolean, SET_RESULT_* record values. */
+#define SET_REGF_Z(x) $Z = !(x);
+#define GET_REGF_Z() (($Z & 0xFF) == 0)
+#define SET_REGF_N(x) $NH = ($NH & ~0x10000) | ((x) << 16);
+#define GET_REGF_N() (($NH >> 16) & 1)
 #define SET_REGF_H(x) $NH = ($NH & ~0x10) | ((x) << 4);
 #define GET_REGF_H() (($NH >> 4) & 1)
-#define SET_REGF_C(x) $CR = (x);
-#define GET_REGF_C() ($CR)
+#define SET_REGF_C(x) $CR = (x) << 8;
+#define GET_REGF_C() (($CR >> 8) & 1)
+
+#define SET_RESULT_Z(r) $Z = (r);
+/* h must be below 0x10000. */
+#define SET_RESULT_NH(n, h) $NH = ((n) << 16) | (h);
+#define SET_RESULT_C(r) $CR = (r);
+
+/* Host registers that are pinned, and so not saved by functions in this file
+ * on behalf of their callers. */
+#if PEANUT_GB_PINNED_REGS && defined(__arm__)
+typedef uint32_t host_regs_t[8];
+#elif PEANUT_GB_PINNED_REGS
+typedef uint64_t host_regs_t[5];
+#else
+typedef uint8_t host_regs_t[1];
+#endif
+
+static inline void save_host_regs(host_regs_t save)
+{
+    #if PEANUT_GB_PINNED_REGS && defined(__arm__)
+    __asm__ volatile(
+        "stm %[save], {r4-r11}"
+        :
+        : [save] "r" (save)
+        : "memory"
+    );
+    #elif PEANUT_GB_PINNED_REGS
+    __asm__ volatile(
+        "mov %%rbx, 0(%[save])\n\t"
+        "mov %%r12, 8(%[save])\n\t"
+        "mov %%r13, 16(%[save])\n\t"
+        "mov %%r14, 24(%[save])\n\t"
+        "mov %%r15, 32(%[save])"
+        :
+        : [save] "r" (save)
+        : "memory"
+    );
+    #else
+    (void) save;
+    #endif
+}
+
+static inline void restore_host_regs(host_regs_t save)
+{
+    #if PEANUT_GB_PINNED_REGS && defined(__arm__)
+    __asm__ volatile(
+        "ldm %[save], {r4-r11}"
+        :
+        : [save] "r" (save)
+        : "memory"
+    );
+    #elif PEANUT_GB_PINNED_REGS
+    __asm__ volatile(
+        "mov 0(%[save]), %%rbx\n\t"
+        "mov 8(%[save]), %%r12\n\t"
+        "mov 16(%[save]), %%r13\n\t"
+        "mov 24(%[save]), %%r14\n\t"
+        "mov 32(%[save]), %%r15"
+        :
+        : [save] "r" (save)
+        : "memory"
+    );
+    #else
+    (void) save;
+    #endif
+}
 
 static inline void load_regs(struct cpu_registers_s *regs)
 {
-    #if ARMASM
-    __asm__(
-        "ldm %[regs], {" R_A ", " R_NH ", " R_Z ", " R_CR ", " R_PC "}"
+    #if PEANUT_GB_PINNED_REGS && ARMASM
+    __asm__ volatile(
+        "ldm %[regs], {" R_BC ", " R_A ", " R_NH ", " R_Z ", " R_CR ", "
+            R_PC ", " R_DE ", " R_HL "}"
         :
         : [regs] "r" (regs)
+        : "memory"
     );
-    #else
+    #elif PEANUT_GB_PINNED_REGS
 	$A = regs->a;
     $NH = regs->nh;
     $Z = regs->z;
     $CR = regs->cr;
 	$PC = regs->pc;
+    #else
+    (void) regs;
     #endif
-    //$HL = regs->hl;
-	//$BC = regs->bc;
-	//$DE = regs->de;
-	//$SP = regs->sp
 }
 
 static inline void store_regs(struct cpu_registers_s *regs)
 {
-    #if ARMASM
-    __asm__(
-        "stm %[regs], {" R_A ", " R_NH ", " R_Z ", " R_CR ", " R_PC "}"
+    #if PEANUT_GB_PINNED_REGS && ARMASM
+    __asm__ volatile(
+        "stm %[regs], {" R_BC ", " R_A ", " R_NH ", " R_Z ", " R_CR ", "
+            R_PC ", " R_DE ", " R_HL "}"
         :
         : [regs] "r" (regs)
+        : "memory"
     );
-    #else
+    #elif PEANUT_GB_PINNED_REGS
 	regs->a = $A;
     regs->nh = $NH;
     regs->z = $Z;
     regs->cr = $CR;
 	regs->pc = $PC;
+    #else
+    (void) regs;
     #endif
-    //regs->hl = $HL;
-	//regs->bc = $BC;
-	//regs->de = $DE;
-	//regs->sp = $SP;
 }
-
-#define $HL regs->hl
\ No newline at end of file
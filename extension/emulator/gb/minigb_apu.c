@@ -27,7 +27,6 @@
 
 // #define AUDIO_NSAMPLES ((unsigned)(AUDIO_SAMPLE_RATE / VERTICAL_SYNC) * 2)
 
-#define AUDIO_MEM_SIZE		(0xFF3F - 0xFF10 + 1)
 #define AUDIO_ADDR_COMPENSATION	0xFF10
 
 #define MAX(a, b) ( a > b ? a : b )
@@ -45,88 +44,23 @@
 #define MAX_CHAN_VOLUME		15
 
 
-/**
- * Memory holding audio registers between 0xFF10 and 0xFF3F inclusive.
- */
-static uint8_t audio_mem[AUDIO_MEM_SIZE];
-
-struct chan_len_ctr {
-	uint8_t load;
-	unsigned enabled : 1;
-	uint32_t counter;
-	uint32_t inc;
-};
-
-struct chan_vol_env {
-	uint8_t step;
-	unsigned up : 1;
-	uint32_t counter;
-	uint32_t inc;
-};
-
-struct chan_freq_sweep {
-	uint16_t freq;
-	uint8_t rate;
-	uint8_t shift;
-	unsigned up : 1;
-	uint32_t counter;
-	uint32_t inc;
-};
-
-static struct chan {
-	unsigned enabled : 1;
-	unsigned powered : 1;
-	unsigned on_left : 1;
-	unsigned on_right : 1;
-	unsigned muted : 1;
-
-	uint8_t volume;
-	uint8_t volume_init;
-
-	uint16_t freq;
-	uint32_t freq_counter;
-	uint32_t freq_inc;
-
-	int_fast16_t val;
-
-	struct chan_len_ctr    len;
-	struct chan_vol_env    env;
-	struct chan_freq_sweep sweep;
-
-	union {
-		struct {
-			uint8_t duty;
-			uint8_t duty_counter;
-		} square;
-		struct {
-			uint16_t lfsr_reg;
-			uint8_t  lfsr_wide;
-			uint8_t  lfsr_div;
-		} noise;
-		struct {
-			uint8_t sample;
-		} wave;
-	};
-} chans[4];
-
-static int32_t vol_l, vol_r;
-
 static void set_note_freq(struct chan *c, const uint32_t freq)
 {
 	/* Lowest expected value of freq is 64. */
 	c->freq_inc = freq * (uint32_t)(FREQ_INC_REF / AUDIO_SAMPLE_RATE);
 }
 
-static void chan_enable(const uint_fast8_t i, const bool enable)
+static void chan_enable(struct minigb_apu_ctx *ctx, const uint_fast8_t i,
+		const bool enable)
 {
 	uint8_t val;
 
-	chans[i].enabled = enable;
-	val = (audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] & 0x80) |
-		(chans[3].enabled << 3) | (chans[2].enabled << 2) |
-		(chans[1].enabled << 1) | (chans[0].enabled << 0);
+	ctx->chans[i].enabled = enable;
+	val = (ctx->audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] & 0x80) |
+		(ctx->chans[3].enabled << 3) | (ctx->chans[2].enabled << 2) |
+		(ctx->chans[1].enabled << 1) | (ctx->chans[0].enabled << 0);
 
-	audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] = val;
+	ctx->audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] = val;
 	//audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] |= 0x80 | ((uint8_t)enable) << i;
 }
 
@@ -146,14 +80,14 @@ static void update_env(struct chan *c)
 	}
 }
 
-static void update_len(struct chan *c)
+static void update_len(struct minigb_apu_ctx *ctx, struct chan *c)
 {
 	if (!c->len.enabled)
 		return;
 
 	c->len.counter += c->len.inc;
 	if (c->len.counter > FREQ_INC_REF) {
-		chan_enable(c - chans, 0);
+		chan_enable(ctx, c - ctx->chans, 0);
 		c->len.counter = 0;
 	}
 }
@@ -198,10 +132,11 @@ static void update_sweep(struct chan *c)
 	}
 }
 
-static void update_square(int16_t *restrict left, int16_t *restrict right, const bool ch2, int len)
+static void update_square(struct minigb_apu_ctx *ctx, int16_t *restrict left,
+		int16_t *restrict right, const bool ch2, int len)
 {
 	uint32_t freq;
-	struct chan* c = chans + ch2;
+	struct chan* c = ctx->chans + ch2;
 
 	if (!c->powered || !c->enabled)
 		return;
@@ -211,7 +146,7 @@ static void update_square(int16_t *restrict left, int16_t *restrict right, const
 	c->freq_inc *= 8;
 
 	for (uint_fast16_t i = 0; i < len; i++) {
-		update_len(c);
+		update_len(ctx, c);
 
 		if (!c->enabled)
 			continue;
@@ -240,16 +175,17 @@ static void update_square(int16_t *restrict left, int16_t *restrict right, const
 		sample *= c->volume;
 		sample /= 4;
 
-		left[i] += sample * c->on_left * vol_l;
-		right[i] += sample * c->on_right * vol_r;
+		left[i] += sample * c->on_left * ctx->vol_l;
+		right[i] += sample * c->on_right * ctx->vol_r;
 	}
 }
 
-static uint8_t wave_sample(const unsigned int pos, const unsigned int volume)
+static uint8_t wave_sample(struct minigb_apu_ctx *ctx, const unsigned int pos,
+		const unsigned int volume)
 {
 	uint8_t sample;
 
-	sample =  audio_mem[(0xFF30 + pos / 2) - AUDIO_ADDR_COMPENSATION];
+	sample =  ctx->audio_mem[(0xFF30 + pos / 2) - AUDIO_ADDR_COMPENSATION];
 	if (pos & 1) {
 		sample &= 0xF;
 	} else {
@@ -258,10 +194,11 @@ static uint8_t wave_sample(const unsigned int pos, const unsigned int volume)
 	return volume ? (sample >> (volume - 1)) : 0;
 }
 
-static void update_wave(int16_t *restrict left, int16_t *restrict right, int len)
+static void update_wave(struct minigb_apu_ctx *ctx, int16_t *restrict left,
+		int16_t *restrict right, int len)
 {
 	uint32_t freq;
-	struct chan *c = chans + 2;
+	struct chan *c = ctx->chans + 2;
 
 	if (!c->powered || !c->enabled)
 		return;
@@ -272,7 +209,7 @@ static void update_wave(int16_t *restrict left, int16_t *restrict right, int len
 	c->freq_inc *= 32;
 
 	for (uint_fast16_t i = 0; i < len; i++) {
-		update_len(c);
+		update_len(ctx, c);
 
 		if (!c->enabled)
 			continue;
@@ -281,13 +218,13 @@ static void update_wave(int16_t *restrict left, int16_t *restrict right, int len
 		uint32_t prev_pos = 0;
 		int32_t sample   = 0;
 
-		c->wave.sample = wave_sample(c->val, c->volume);
+		c->wave.sample = wave_sample(ctx, c->val, c->volume);
 
 		while (update_freq(c, &pos)) {
 			c->val = (c->val + 1) & 31;
 			sample += ((pos - prev_pos) / c->freq_inc) *
 				((int)c->wave.sample - 8) * (INT16_MAX/64);
-			c->wave.sample = wave_sample(c->val, c->volume);
+			c->wave.sample = wave_sample(ctx, c->val, c->volume);
 			prev_pos  = pos;
 		}
 
@@ -307,14 +244,15 @@ static void update_wave(int16_t *restrict left, int16_t *restrict right, int len
 
 		sample /= 4;
 
-		left[i] += sample * c->on_left * vol_l;
-		right[i] += sample * c->on_right * vol_r;
+		left[i] += sample * c->on_left * ctx->vol_l;
+		right[i] += sample * c->on_right * ctx->vol_r;
 	}
 }
 
-static void update_noise(int16_t *restrict left, int16_t *restrict right, int len)
+static void update_noise(struct minigb_apu_ctx *ctx, int16_t *restrict left,
+		int16_t *restrict right, int len)
 {
-	struct chan *c = chans + 3;
+	struct chan *c = ctx->chans + 3;
 
 	if (!c->powered)
 		return;
@@ -333,7 +271,7 @@ static void update_noise(int16_t *restrict left, int16_t *restrict right, int le
 		c->enabled = 0;
 
 	for (uint_fast16_t i = 0; i < len; i++) {
-		update_len(c);
+		update_len(ctx, c);
 
 		if (!c->enabled)
 			continue;
@@ -371,22 +309,22 @@ static void update_noise(int16_t *restrict left, int16_t *restrict right, int le
 		sample *= c->volume;
 		sample /= 4;
 
-		left[i] += sample * c->on_left * vol_l;
-		right[i] += sample * c->on_right * vol_r;
+		left[i] += sample * c->on_left * ctx->vol_l;
+		right[i] += sample * c->on_right * ctx->vol_r;
 	}
 }
 
-static void chan_trigger(uint_fast8_t i)
+static void chan_trigger(struct minigb_apu_ctx *ctx, uint_fast8_t i)
 {
-	struct chan *c = chans + i;
+	struct chan *c = ctx->chans + i;
 
-	chan_enable(i, 1);
+	chan_enable(ctx, i, 1);
 	c->volume = c->volume_init;
 
 	// volume envelope
 	{
 		uint8_t val =
-			audio_mem[(0xFF12 + (i * 5)) - AUDIO_ADDR_COMPENSATION];
+			ctx->audio_mem[(0xFF12 + (i * 5)) - AUDIO_ADDR_COMPENSATION];
 
 		c->env.step = val & 0x07;
 		c->env.up   = val & 0x08 ? 1 : 0;
@@ -398,7 +336,7 @@ static void chan_trigger(uint_fast8_t i)
 
 	// freq sweep
 	if (i == 0) {
-		uint8_t val = audio_mem[0xFF10 - AUDIO_ADDR_COMPENSATION];
+		uint8_t val = ctx->audio_mem[0xFF10 - AUDIO_ADDR_COMPENSATION];
 
 		c->sweep.freq  = c->freq;
 		c->sweep.rate  = (val >> 4) & 0x07;
@@ -429,7 +367,7 @@ static void chan_trigger(uint_fast8_t i)
  *				This is not checked in this function.
  * \return		Byte at address.
  */
-uint8_t audio_read(const uint16_t addr)
+uint8_t audio_read(struct minigb_apu_ctx *ctx, const uint16_t addr)
 {
  static const uint8_t ortab[] = {
 	 0x80, 0x3f, 0x00, 0xff, 0xbf,
@@ -442,7 +380,7 @@ uint8_t audio_read(const uint16_t addr)
 	 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
  };
 
- return audio_mem[addr - AUDIO_ADDR_COMPENSATION] |
+ return ctx->audio_mem[addr - AUDIO_ADDR_COMPENSATION] |
 	 ortab[addr - AUDIO_ADDR_COMPENSATION];
 }
 
@@ -452,129 +390,130 @@ uint8_t audio_read(const uint16_t addr)
  *				This is not checked in this function.
  * \param val	Byte to write at address.
  */
-void audio_write(const uint16_t addr, const uint8_t val)
+void audio_write(struct minigb_apu_ctx *ctx, const uint16_t addr,
+		const uint8_t val)
  {
 	 /* Find sound channel corresponding to register address. */
 	 uint_fast8_t i;
  
 	 if(addr == 0xFF26)
 	 {
-		 audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
+		 ctx->audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
 		 /* On APU power off, clear all registers apart from wave
 			* RAM. */
 		 if((val & 0x80) == 0)
 		 {
-			 memset(audio_mem, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
-			 chans[0].enabled = false;
-			 chans[1].enabled = false;
-			 chans[2].enabled = false;
-			 chans[3].enabled = false;
+			 memset(ctx->audio_mem, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
+			 ctx->chans[0].enabled = false;
+			 ctx->chans[1].enabled = false;
+			 ctx->chans[2].enabled = false;
+			 ctx->chans[3].enabled = false;
 		 }
  
 		 return;
 	 }
  
 	 /* Ignore register writes if APU powered off. */
-	 if(audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] == 0x00)
+	 if(ctx->audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] == 0x00)
 		 return;
  
-	 audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val;
+	 ctx->audio_mem[addr - AUDIO_ADDR_COMPENSATION] = val;
 	 i = (addr - AUDIO_ADDR_COMPENSATION) / 5;
  
 	 switch (addr) {
 	 case 0xFF12:
 	 case 0xFF17:
 	 case 0xFF21: {
-		 chans[i].volume_init = val >> 4;
-		 chans[i].powered     = (val >> 3) != 0;
+		 ctx->chans[i].volume_init = val >> 4;
+		 ctx->chans[i].powered     = (val >> 3) != 0;
  
 		 // "zombie mode" stuff, needed for Prehistorik Man and probably
 		 // others
-		 if (chans[i].powered && chans[i].enabled) {
-			 if ((chans[i].env.step == 0 && chans[i].env.inc != 0)) {
+		 if (ctx->chans[i].powered && ctx->chans[i].enabled) {
+			 if ((ctx->chans[i].env.step == 0 && ctx->chans[i].env.inc != 0)) {
 				 if (val & 0x08) {
-					 chans[i].volume++;
+					 ctx->chans[i].volume++;
 				 } else {
-					 chans[i].volume += 2;
+					 ctx->chans[i].volume += 2;
 				 }
 			 } else {
-				 chans[i].volume = 16 - chans[i].volume;
+				 ctx->chans[i].volume = 16 - ctx->chans[i].volume;
 			 }
  
-			 chans[i].volume &= 0x0F;
-			 chans[i].env.step = val & 0x07;
+			 ctx->chans[i].volume &= 0x0F;
+			 ctx->chans[i].env.step = val & 0x07;
 		 }
 	 } break;
  
 	 case 0xFF1C:
-		 chans[i].volume = chans[i].volume_init = (val >> 5) & 0x03;
+		 ctx->chans[i].volume = ctx->chans[i].volume_init = (val >> 5) & 0x03;
 		 break;
  
 	 case 0xFF11:
 	 case 0xFF16:
 	 case 0xFF20: {
 		 const uint8_t duty_lookup[] = { 0x10, 0x30, 0x3C, 0xCF };
-		 chans[i].len.load = val & 0x3f;
-		 chans[i].square.duty = duty_lookup[val >> 6];
+		 ctx->chans[i].len.load = val & 0x3f;
+		 ctx->chans[i].square.duty = duty_lookup[val >> 6];
 		 break;
 	 }
  
 	 case 0xFF1B:
-		 chans[i].len.load = val;
+		 ctx->chans[i].len.load = val;
 		 break;
  
 	 case 0xFF13:
 	 case 0xFF18:
 	 case 0xFF1D:
-		 chans[i].freq &= 0xFF00;
-		 chans[i].freq |= val;
+		 ctx->chans[i].freq &= 0xFF00;
+		 ctx->chans[i].freq |= val;
 		 break;
  
 	 case 0xFF1A:
-		 chans[i].powered = (val & 0x80) != 0;
-		 chan_enable(i, val & 0x80);
+		 ctx->chans[i].powered = (val & 0x80) != 0;
+		 chan_enable(ctx, i, val & 0x80);
 		 break;
  
 	 case 0xFF14:
 	 case 0xFF19:
 	 case 0xFF1E:
-		 chans[i].freq &= 0x00FF;
-		 chans[i].freq |= ((val & 0x07) << 8);
+		 ctx->chans[i].freq &= 0x00FF;
+		 ctx->chans[i].freq |= ((val & 0x07) << 8);
 		 /* Intentional fall-through. */
 	 case 0xFF23:
-		 chans[i].len.enabled = val & 0x40 ? 1 : 0;
+		 ctx->chans[i].len.enabled = val & 0x40 ? 1 : 0;
 		 if (val & 0x80)
-			 chan_trigger(i);
+			 chan_trigger(ctx, i);
  
 		 break;
  
 	 case 0xFF22:
-		 chans[3].freq = val >> 4;
-		 chans[3].noise.lfsr_wide = !(val & 0x08);
-		 chans[3].noise.lfsr_div = val & 0x07;
+		 ctx->chans[3].freq = val >> 4;
+		 ctx->chans[3].noise.lfsr_wide = !(val & 0x08);
+		 ctx->chans[3].noise.lfsr_div = val & 0x07;
 		 break;
  
 	 case 0xFF24:
 	 {
-		 vol_l = ((val >> 4) & 0x07);
-		 vol_r = (val & 0x07);
+		 ctx->vol_l = ((val >> 4) & 0x07);
+		 ctx->vol_r = (val & 0x07);
 		 break;
 	 }
  
 	 case 0xFF25:
 		 for (uint_fast8_t j = 0; j < 4; j++) {
-			 chans[j].on_left  = (val >> (4 + j)) & 1;
-			 chans[j].on_right = (val >> j) & 1;
+			 ctx->chans[j].on_left  = (val >> (4 + j)) & 1;
+			 ctx->chans[j].on_right = (val >> j) & 1;
 		 }
 		 break;
 	 }
  }
 
-void audio_init(void)
+void audio_init(struct minigb_apu_ctx *ctx)
 {
 	/* Initialise channels and samples. */
-	memset(chans, 0, sizeof(chans));
-	chans[0].val = chans[1].val = -1;
+	memset(ctx->chans, 0, sizeof(ctx->chans));
+	ctx->chans[0].val = ctx->chans[1].val = -1;
 	
 	/* Initialise IO registers. */
 	{
@@ -585,7 +524,7 @@ void audio_init(void)
 								0x77, 0xF3, 0xF1 };
 	
 		for(uint_fast8_t i = 0; i < sizeof(regs_init); ++i)
-			audio_write(0xFF10 + i, regs_init[i]);
+			audio_write(ctx, 0xFF10 + i, regs_init[i]);
 	}
 	
 	/* Initialise Wave Pattern RAM. */
@@ -596,15 +535,17 @@ void audio_init(void)
 								0xac, 0xdd, 0xda, 0x48 };
 	
 		for(uint_fast8_t i = 0; i < sizeof(wave_init); ++i)
-			audio_write(0xFF30 + i, wave_init[i]);
+			audio_write(ctx, 0xFF30 + i, wave_init[i]);
 	}
 }
 
 int GKAudioSourceCallback(void* context, int16_t* left, int16_t* right, int len) {
-	update_square(left, right, 0, len);
-	update_square(left, right, 1, len);
-	update_wave(left, right, len);
-	update_noise(left, right, len);
+	struct minigb_apu_ctx *ctx = context;
+
+	update_square(ctx, left, right, 0, len);
+	update_square(ctx, left, right, 1, len);
+	update_wave(ctx, left, right, len);
+	update_noise(ctx, left, right, len);
 	
 	for(int i = 0; i < len; ++i) {
 		if(left[i] != 0 || right[i] != 0) return 1;
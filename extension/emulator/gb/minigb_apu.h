@@ -10,6 +10,80 @@
 
 #include <stdint.h>
 
+#define AUDIO_MEM_SIZE		(0xFF3F - 0xFF10 + 1)
+
+struct chan_len_ctr {
+	uint8_t load;
+	unsigned enabled : 1;
+	uint32_t counter;
+	uint32_t inc;
+};
+
+struct chan_vol_env {
+	uint8_t step;
+	unsigned up : 1;
+	uint32_t counter;
+	uint32_t inc;
+};
+
+struct chan_freq_sweep {
+	uint16_t freq;
+	uint8_t rate;
+	uint8_t shift;
+	unsigned up : 1;
+	uint32_t counter;
+	uint32_t inc;
+};
+
+struct chan {
+	unsigned enabled : 1;
+	unsigned powered : 1;
+	unsigned on_left : 1;
+	unsigned on_right : 1;
+	unsigned muted : 1;
+
+	uint8_t volume;
+	uint8_t volume_init;
+
+	uint16_t freq;
+	uint32_t freq_counter;
+	uint32_t freq_inc;
+
+	int_fast16_t val;
+
+	struct chan_len_ctr    len;
+	struct chan_vol_env    env;
+	struct chan_freq_sweep sweep;
+
+	union {
+		struct {
+			uint8_t duty;
+			uint8_t duty_counter;
+		} square;
+		struct {
+			uint16_t lfsr_reg;
+			uint8_t  lfsr_wide;
+			uint8_t  lfsr_div;
+		} noise;
+		struct {
+			uint8_t sample;
+		} wave;
+	};
+};
+
+/**
+ * State of one APU. Each emulator instance has its own.
+ */
+struct minigb_apu_ctx {
+	struct chan chans[4];
+	int32_t vol_l, vol_r;
+
+	/**
+	 * Memory holding audio registers between 0xFF10 and 0xFF3F inclusive.
+	 */
+	uint8_t audio_mem[AUDIO_MEM_SIZE];
+};
+
 /**
  * Fill allocated buffer "data" with "len" number of 32-bit floating point
  * samples (native endian order) in stereo interleaved format.
@@ -19,19 +93,24 @@
 /**
  * Read audio register at given address "addr".
  */
-uint8_t audio_read(const uint16_t addr);
+uint8_t audio_read(struct minigb_apu_ctx *ctx, const uint16_t addr);
 
 /**
  * Write "val" to audio register at given address "addr".
  */
-void audio_write(const uint16_t addr, const uint8_t val);
+void audio_write(struct minigb_apu_ctx *ctx, const uint16_t addr,
+		const uint8_t val);
 
 /**
  * Initialise audio driver.
  */
-void audio_init(void);
+void audio_init(struct minigb_apu_ctx *ctx);
 
 
+/**
+ * Playdate audio source callback. context is the struct minigb_apu_ctx to
+ * render.
+ */
 int GKAudioSourceCallback(void* context, int16_t* left, int16_t* right, int len);
 
 #endif
\ No newline at end of file
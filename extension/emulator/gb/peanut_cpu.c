@@ -1,9 +1,15 @@
 #include "peanut_gb.h"
-
-struct gb_s *peanut_exec_gb = NULL;
-
 #include "cpu_access.h"
 
+/* Called after a relative jump is taken. */
+#if PEANUT_GB_IDLE_LOOP_SKIP
+#define IDLE_LOOP_CHECK(offset) \
+	if((offset) < 0) \
+		__gb_idle_loop(gb, $PC, ($PC - (offset) - 2) & 0xFFFF);
+#else
+#define IDLE_LOOP_CHECK(offset)
+#endif
+
 static uint8_t __get_f(struct cpu_registers_s *regs)
 {
 	return (GET_REGF_Z() << 7)
@@ -23,9 +29,9 @@ static void __set_f(struct cpu_registers_s *regs, uint8_t v)
 static void __gb_add16(struct cpu_registers_s *regs, uint16_t value)
 {
 	uint_fast32_t temp = $HL + value;
-	SET_REGF_N(0)
-	SET_REGF_H((temp ^ $HL ^ value) & 0x1000 ? 1 : 0)
-	SET_REGF_C((temp & 0xFFFF0000) ? 1 : 0)
+	/* H and C come from bits 12 and 16. */
+	SET_RESULT_NH(0, (temp ^ $HL ^ value) >> 8)
+	SET_RESULT_C(temp >> 8)
 	$HL = (temp & 0x0000FFFF);
 }
 
@@ -33,10 +39,9 @@ static void __gb_add8(struct cpu_registers_s *regs, int carry, uint8_t value)
 {
 	uint8_t c = carry ? GET_REGF_C() : 0;
 	uint16_t temp = $A + value + c;
-	SET_REGF_Z(((temp & 0xFF) == 0x00))
-	SET_REGF_N(0)
-	SET_REGF_H(($A ^ value ^ temp) & 0x10 ? 1 : 0)
-	SET_REGF_C((temp & 0xFF00) ? 1 : 0)
+	SET_RESULT_Z(temp)
+	SET_RESULT_NH(0, $A ^ value ^ temp)
+	SET_RESULT_C(temp)
 	$A = (temp & 0xFF);
 }
 
@@ -44,32 +49,106 @@ static inline uint8_t __gb_cmp8(struct cpu_registers_s *regs, int carry, uint8_t
 {
 	uint8_t c = carry ? GET_REGF_C() : 0;
 	uint16_t temp = $A - value - c;
-	SET_REGF_Z(((temp & 0xFF) == 0x00))
-	SET_REGF_N(1)
-	SET_REGF_H(($A ^ value ^ temp) & 0x10 ? 1 : 0)
-	SET_REGF_C((temp & 0xFF00) ? 1 : 0)
+	SET_RESULT_Z(temp)
+	SET_RESULT_NH(1, $A ^ value ^ temp)
+	SET_RESULT_C(temp)
 	return (temp & 0xFF);
 }
 
+static inline uint8_t __gb_inc8(struct cpu_registers_s *regs, uint8_t value)
+{
+	uint8_t temp = value + 1;
+	SET_RESULT_Z(temp)
+	SET_RESULT_NH(0, value ^ temp)
+	return temp;
+}
+
+static inline uint8_t __gb_dec8(struct cpu_registers_s *regs, uint8_t value)
+{
+	uint8_t temp = value - 1;
+	SET_RESULT_Z(temp)
+	SET_RESULT_NH(1, value ^ temp)
+	return temp;
+}
+
 static void __gb_sub8(struct cpu_registers_s *regs, int carry, uint8_t value)
 {
 	$A = __gb_cmp8(regs, carry, value);
 }
 
-static uint8_t __gb_cpu_read(uint16_t addr)
+static uint8_t __gb_cpu_read(struct gb_s *gb, uint16_t addr)
+{
+	const uint8_t *page = gb->read_page[addr >> 12];
+
+	if(page != NULL)
+		return page[addr & 0xFFF];
+
+	return __gb_read(gb, addr);
+}
+
+static void __gb_cpu_write(struct gb_s *gb, uint16_t addr, uint8_t value)
+{
+	uint8_t *page = gb->write_page[addr >> 12];
+
+	if(page != NULL)
+		page[addr & 0xFFF] = value;
+	else
+		__gb_write(gb, addr, value);
+}
+
+/* 16-bit accesses are done with one page lookup, unless the two bytes fall on
+ * different pages. */
+static uint16_t __gb_cpu_read16(struct gb_s *gb, uint16_t addr)
+{
+	const uint8_t *page = gb->read_page[addr >> 12];
+
+	if(page != NULL && (addr & 0xFFF) != 0xFFF)
+	{
+		page += addr & 0xFFF;
+		return page[0] | (page[1] << 8);
+	}
+
+	return __gb_cpu_read(gb, addr) | (__gb_cpu_read(gb, addr + 1) << 8);
+}
+
+/* Otherwise the high byte is written first, as PUSH does. Only used for PUSH;
+ * LD (imm), SP writes the low byte first. */
+static void __gb_cpu_write16(struct gb_s *gb, uint16_t addr, uint16_t value)
+{
+	uint8_t *page = gb->write_page[addr >> 12];
+
+	if(page != NULL && (addr & 0xFFF) != 0xFFF)
+	{
+		page += addr & 0xFFF;
+		page[0] = value & 0xFF;
+		page[1] = value >> 8;
+	}
+	else
+	{
+		__gb_cpu_write(gb, addr + 1, value >> 8);
+		__gb_cpu_write(gb, addr, value & 0xFF);
+	}
+}
+
+static inline void __gb_push16(struct gb_s *gb, struct cpu_registers_s *regs,
+		uint16_t value)
 {
-	return __gb_read(peanut_exec_gb, addr);
+	$SP -= 2;
+	__gb_cpu_write16(gb, $SP, value);
 }
 
-static void __gb_cpu_write(uint16_t addr, uint8_t value)
+static inline uint16_t __gb_pop16(struct gb_s *gb,
+		struct cpu_registers_s *regs)
 {
-	__gb_write(peanut_exec_gb, addr, value);
+	uint16_t value = __gb_cpu_read16(gb, $SP);
+	$SP += 2;
+	return value;
 }
 
-static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
+static uint8_t __gb_execute_cb(struct gb_s *gb, struct cpu_registers_s *regs,
+		uint8_t cbop)
 {
 	uint8_t inst_cycles;
-	uint8_t cbop = __gb_cpu_read($PC++);
 	uint8_t r = (cbop & 0x7);
 	uint8_t b = (cbop >> 3) & 0x7;
 	uint8_t d = (cbop >> 3) & 0x1;
@@ -117,7 +196,7 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 		break;
 
 	case 6:
-		val = __gb_cpu_read($HL);
+		val = __gb_cpu_read(gb, $HL);
 		break;
 
 	/* Only values 0-7 are possible here, so we make the final case
@@ -142,9 +221,8 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 				uint8_t temp = val;
 				val = (val >> 1);
 				val |= cbop ? (GET_REGF_C() << 7) : (temp << 7);
-				SET_REGF_Z((val == 0x00))
-				SET_REGF_N(0)
-				SET_REGF_H(0)
+				SET_RESULT_Z(val)
+				SET_RESULT_NH(0, 0)
 				SET_REGF_C((temp & 0x01))
 			}
 			else /* RLC R / RL R */
@@ -152,9 +230,8 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 				uint8_t temp = val;
 				val = (val << 1);
 				val |= cbop ? GET_REGF_C() : (temp >> 7);
-				SET_REGF_Z((val == 0x00))
-				SET_REGF_N(0)
-				SET_REGF_H(0)
+				SET_RESULT_Z(val)
+				SET_RESULT_NH(0, 0)
 				SET_REGF_C((temp >> 7))
 			}
 
@@ -165,17 +242,15 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 			{
 				SET_REGF_C(val & 0x01)
 				val = (val >> 1) | (val & 0x80);
-				SET_REGF_Z((val == 0x00))
-				SET_REGF_N(0)
-				SET_REGF_H(0)
+				SET_RESULT_Z(val)
+				SET_RESULT_NH(0, 0)
 			}
 			else /* SLA R */
 			{
 				SET_REGF_C((val >> 7))
 				val = val << 1;
-				SET_REGF_Z((val == 0x00))
-				SET_REGF_N(0)
-				SET_REGF_H(0)
+				SET_RESULT_Z(val)
+				SET_RESULT_NH(0, 0)
 			}
 
 			break;
@@ -185,18 +260,16 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 			{
 				SET_REGF_C(val & 0x01)
 				val = val >> 1;
-				SET_REGF_Z((val == 0x00))
-				SET_REGF_N(0)
-				SET_REGF_H(0)
+				SET_RESULT_Z(val)
+				SET_RESULT_NH(0, 0)
 			}
 			else /* SWAP R */
 			{
 				uint8_t temp = (val >> 4) & 0x0F;
 				temp |= (val << 4) & 0xF0;
 				val = temp;
-				SET_REGF_Z((val == 0x00))
-				SET_REGF_N(0)
-				SET_REGF_H(0)
+				SET_RESULT_Z(val)
+				SET_RESULT_NH(0, 0)
 				SET_REGF_C(0)
 			}
 
@@ -206,9 +279,8 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 		break;
 
 	case 0x1: /* BIT B, R */
-		SET_REGF_Z(!((val >> b) & 0x1))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		SET_RESULT_Z(val & (1 << b))
+		SET_RESULT_NH(0, 0x10)
 		writeback = 0;
 		break;
 
@@ -250,7 +322,7 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 			break;
 
 		case 6:
-			__gb_cpu_write($HL, val);
+			__gb_cpu_write(gb, $HL, val);
 			break;
 
 		case 7:
@@ -261,11 +333,330 @@ static uint8_t __gb_execute_cb(struct cpu_registers_s *regs)
 	return inst_cycles;
 }
 
+/* Instruction lengths in bytes. Instructions that may jump or stop the CPU
+ * are marked with OP_END, and end a block. */
+#define OP_END	0x80
+#define E1	(OP_END | 1)
+#define E2	(OP_END | 2)
+#define E3	(OP_END | 3)
+static const uint8_t op_len[0x100] =
+{
+	/* *INDENT-OFF* */
+	/*0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F	*/
+	  1,  3,  1,  1,  1,  1,  2,  1,  3,  1,  1,  1,  1,  1,  2,  1,	/* 0x00 */
+	 E1,  3,  1,  1,  1,  1,  2,  1, E2,  1,  1,  1,  1,  1,  2,  1,	/* 0x10 */
+	 E2,  3,  1,  1,  1,  1,  2,  1, E2,  1,  1,  1,  1,  1,  2,  1,	/* 0x20 */
+	 E2,  3,  1,  1,  1,  1,  2,  1, E2,  1,  1,  1,  1,  1,  2,  1,	/* 0x30 */
+	  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0x40 */
+	  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0x50 */
+	  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0x60 */
+	  1,  1,  1,  1,  1,  1, E1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0x70 */
+	  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0x80 */
+	  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0x90 */
+	  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0xA0 */
+	  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,	/* 0xB0 */
+	 E1,  1, E3, E3, E3,  1,  2, E1, E1, E1, E3,  2, E3, E3,  2, E1,	/* 0xC0 */
+	 E1,  1, E3, E1, E3,  1,  2, E1, E1, E1, E3, E1, E3, E1,  2, E1,	/* 0xD0 */
+	  2,  1,  1, E1, E1,  1,  2, E1,  2, E1,  3, E1, E1, E1,  2, E1,	/* 0xE0 */
+	  2,  1,  1,  1, E1,  1,  2, E1,  2,  1,  3,  1, E1, E1,  2, E1 	/* 0xF0 */
+	/* *INDENT-ON* */
+};
+#undef E1
+#undef E2
+#undef E3
+
+/* Decode the instruction at pc. */
+static void __gb_decode_op(struct gb_s *gb, const uint16_t pc,
+		struct cpu_op_s *op)
+{
+	op->opcode = __gb_read(gb, pc);
+	op->len = op_len[op->opcode] & ~OP_END;
+	op->imm = 0;
+
+	if(op->len > 1)
+		op->imm = __gb_read(gb, (uint16_t)(pc + 1));
+
+	if(op->len > 2)
+		op->imm |= __gb_read(gb, (uint16_t)(pc + 2)) << 8;
+}
+
+#if PEANUT_GB_BLOCK_CACHE && PEANUT_GB_LOOP_FUSION
+enum cpu_loop_e
+{
+	LOOP_NONE = 0,
+	LOOP_FILL,
+	LOOP_COPY8,
+	LOOP_COPY16,
+	LOOP_COUNT
+};
+
+/* Loops that are run in bulk. Each must be a block by itself, ending with a
+ * JR NZ back to its start. */
+static const struct
+{
+	uint8_t len;
+	/* Cycles per iteration, with the jump taken. */
+	uint8_t cycles;
+	uint8_t code[8];
+} cpu_loops[LOOP_COUNT] =
+{
+	[LOOP_FILL] = { 4, 24, {
+		0x22,		/* LD (HL+), A */
+		0x05,		/* DEC B */
+		0x20, 0xFC	/* JR NZ, -4 */
+	} },
+	[LOOP_COPY8] = { 6, 40, {
+		0x2A,		/* LD A, (HL+) */
+		0x12,		/* LD (DE), A */
+		0x13,		/* INC DE */
+		0x05,		/* DEC B */
+		0x20, 0xFA	/* JR NZ, -6 */
+	} },
+	[LOOP_COPY16] = { 8, 52, {
+		0x2A,		/* LD A, (HL+) */
+		0x12,		/* LD (DE), A */
+		0x13,		/* INC DE */
+		0x0B,		/* DEC BC */
+		0x78,		/* LD A, B */
+		0xB1,		/* OR C */
+		0x20, 0xF8	/* JR NZ, -8 */
+	} }
+};
+
+/* Returns the kind of loop that the len bytes of code at pc are. */
+static uint8_t __gb_match_loop(struct gb_s *gb, const uint16_t pc,
+		const uint_fast8_t len)
+{
+	for(uint_fast8_t loop = LOOP_NONE + 1; loop < LOOP_COUNT; loop++)
+	{
+		uint_fast8_t i = 0;
+
+		if(cpu_loops[loop].len != len)
+			continue;
+
+		while(i < len && __gb_read(gb, pc + i) == cpu_loops[loop].code[i])
+			i++;
+
+		if(i == len)
+			return loop;
+	}
+
+	return LOOP_NONE;
+}
+
+/* Returns a pointer to the VRAM or WRAM at addr, and the number of bytes
+ * after it in the same area, or NULL for any other address. */
+static uint8_t *__gb_ram_ptr(struct gb_s *gb, const uint_fast16_t addr,
+		uint_fast16_t *avail)
+{
+	if(addr >= VRAM_ADDR && addr < CART_RAM_ADDR)
+	{
+		*avail = CART_RAM_ADDR - addr;
+		return &gb->vram[addr - VRAM_ADDR];
+	}
+
+	if(addr >= WRAM_0_ADDR && addr < ECHO_ADDR)
+	{
+		*avail = ECHO_ADDR - addr;
+		return &gb->wram[addr - WRAM_0_ADDR];
+	}
+
+	return NULL;
+}
+
+/**
+ * Called on entering a block that is a copy or fill loop. Runs as many
+ * iterations as can complete before the next event, leaving the registers,
+ * flags and cycle count as though they had been run one at a time. The last
+ * iteration is always left to the interpreter.
+ */
+static void __gb_run_loop(struct cpu_registers_s *regs, struct gb_s *gb,
+		const uint_fast8_t loop)
+{
+	const uint_fast8_t cycles = cpu_loops[loop].cycles;
+	uint_fast32_t n;
+	uint_fast16_t avail;
+	uint8_t *dst;
+
+	if(gb->counter.cycles >= gb->counter.event_cycles)
+		return;
+
+	if(loop == LOOP_COPY16)
+		n = $BC ? $BC : 0x10000;
+	else
+		n = GET_REG_B() ? GET_REG_B() : 0x100;
+
+	n = MIN(n - 1, (gb->counter.event_cycles - gb->counter.cycles - 1) /
+			cycles);
+
+	dst = __gb_ram_ptr(gb, loop == LOOP_FILL ? $HL : $DE, &avail);
+
+	if(dst == NULL)
+		return;
+
+	n = MIN(n, avail);
+
+	if(loop == LOOP_FILL)
+	{
+		if(n == 0)
+			return;
+
+		memset(dst, $A, n);
+	}
+	else if($HL < VRAM_ADDR)
+	{
+		/* Stay within the ROM bank. */
+		n = MIN(n, ($HL < ROM_N_ADDR ? ROM_N_ADDR : VRAM_ADDR) - $HL);
+
+		if(n == 0)
+			return;
+
+		for(uint_fast16_t i = 0; i < n; i++)
+			dst[i] = __gb_read(gb, $HL + i);
+	}
+	else
+	{
+		const uint8_t *src = __gb_ram_ptr(gb, $HL, &avail);
+
+		if(src == NULL)
+			return;
+
+		n = MIN(n, avail);
+
+		if(n == 0)
+			return;
+
+		/* Copy byte by byte when dst overlaps the end of src, so that
+		 * the copied bytes repeat as they would on hardware. */
+		if(dst > src && dst < src + n)
+		{
+			for(uint_fast16_t i = 0; i < n; i++)
+				dst[i] = src[i];
+		}
+		else
+			memmove(dst, src, n);
+	}
+
+#if ENABLE_LCD
+	if(dst < gb->vram + VRAM_SIZE && dst >= gb->vram)
+		__gb_vram_written(gb, dst - gb->vram, n);
+#endif
+
+	$HL += n;
+	gb->counter.cycles += n * cycles;
+
+	switch(loop)
+	{
+	case LOOP_FILL:
+		SET_REG_B(__gb_dec8(regs, GET_REG_B() - n + 1))
+		break;
+
+	case LOOP_COPY8:
+		$DE += n;
+		SET_REG_B(__gb_dec8(regs, GET_REG_B() - n + 1))
+		$A = dst[n - 1];
+		break;
+
+	case LOOP_COPY16:
+		$DE += n;
+		$BC -= n;
+		$A = GET_REG_B() | GET_REG_C();
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
+		SET_REGF_C(0)
+		break;
+	}
+}
+#endif
+
+/**
+ * Returns the decoded block starting at pc. Code in ROM is decoded once per
+ * bank and kept in gb->block_cache. Code anywhere else may be modified, so
+ * only the instruction at pc is decoded, into scratch.
+ */
+static const struct cpu_block_s *__gb_get_block(struct gb_s *gb,
+		const uint16_t pc, struct cpu_block_s *scratch)
+{
+#if PEANUT_GB_BLOCK_CACHE
+	/* ROM reads as 0xFF during OAM DMA, which must not be cached. */
+	if(pc < VRAM_ADDR && !DMA_ACTIVE(gb))
+	{
+		const uint_fast16_t limit = pc < ROM_N_ADDR ? ROM_N_ADDR : VRAM_ADDR;
+		uint16_t bank = 0;
+		struct cpu_block_s *set, *block;
+		uint_fast16_t addr = pc;
+		uint_fast8_t i;
+
+		if(pc >= ROM_N_ADDR)
+			bank = __gb_rom_bank(gb);
+
+		set = gb->block_cache.block[(pc ^ bank) % BLOCK_CACHE_SETS];
+		block = &set[0];
+		gb->block_cache.clock++;
+
+		for(i = 0; i < BLOCK_CACHE_WAYS; i++)
+		{
+			if(set[i].count && set[i].pc == pc && set[i].bank == bank)
+			{
+				set[i].used = gb->block_cache.clock;
+				return &set[i];
+			}
+
+			/* Evict the least recently used block. */
+			if(set[i].used < block->used)
+				block = &set[i];
+		}
+
+		block->pc = pc;
+		block->bank = bank;
+		block->used = gb->block_cache.clock;
+
+		for(i = 0; i < BLOCK_MAX_OPS; i++)
+		{
+			struct cpu_op_s *op = &block->op[i];
+
+			__gb_decode_op(gb, addr, op);
+
+			/* Stop before an instruction that crosses into the
+			 * next region, as that may be banked separately. */
+			if(addr + op->len > limit)
+				break;
+
+			addr += op->len;
+
+			if((op_len[op->opcode] & OP_END) || addr == limit)
+			{
+				i++;
+				break;
+			}
+		}
+
+		block->count = i;
+		block->loop = 0;
+
+#if PEANUT_GB_LOOP_FUSION
+		if(i > 0 && block->op[i - 1].opcode == 0x20)
+			block->loop = __gb_match_loop(gb, pc, addr - pc);
+#endif
+
+		if(i > 0)
+			return block;
+	}
+#endif
+
+	__gb_decode_op(gb, pc, &scratch->op[0]);
+	scratch->count = 1;
+	scratch->loop = 0;
+	return scratch;
+}
+
 /**
  * Internal function used to step the CPU.
- * Returns number of cycles executed
+ * Runs instructions until counter.cycles reaches counter.event_cycles.
+ * Anything that needs the CPU to stop early, such as a write that changes
+ * timing or an interrupt becoming pending, sets counter.event_cycles to 0.
  */
-static uint8_t __gb_step_cpu(struct cpu_registers_s *regs)
+static void __gb_step_cpu(struct gb_s *gb, struct cpu_registers_s *regs)
 {
 	uint8_t opcode, inst_cycles;
 	static const uint8_t op_cycles[0x100] =
@@ -291,245 +682,308 @@ static uint8_t __gb_step_cpu(struct cpu_registers_s *regs)
 		/* *INDENT-ON* */
 	};
 
+	/* Decoded instructions yet to run, and the current immediate operand. */
+	const struct cpu_op_s *uop = NULL, *uop_end = NULL;
+	struct cpu_block_s scratch;
+	uint16_t imm;
+
+#define IMM8	((uint8_t) imm)
+#define IMM16	imm
+#define FETCH							\
+	do {								\
+		if(uop == uop_end)					\
+			NEXT_BLOCK();					\
+		opcode = uop->opcode;					\
+		imm = uop->imm;						\
+		$PC += uop->len;					\
+		uop++;							\
+		inst_cycles = op_cycles[opcode];			\
+	} while(0)
+#if PEANUT_GB_BLOCK_CACHE && PEANUT_GB_LOOP_FUSION
+#define NEXT_BLOCK()						\
+	do {								\
+		const struct cpu_block_s *block =			\
+			__gb_get_block(gb, $PC, &scratch);	\
+		if(block->loop)						\
+			__gb_run_loop(regs, gb, block->loop);\
+		uop = block->op;					\
+		uop_end = &block->op[block->count];			\
+	} while(0)
+#else
+#define NEXT_BLOCK()						\
+	do {								\
+		const struct cpu_block_s *block =			\
+			__gb_get_block(gb, $PC, &scratch);	\
+		uop = block->op;					\
+		uop_end = &block->op[block->count];			\
+	} while(0)
+#endif
+
+#if PEANUT_GB_THREADED_DISPATCH
+	static const void *const dispatch[0x100] =
+	{
+		/* *INDENT-OFF* */
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+		&&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,	/* 0x00 */
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+		&&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,	/* 0x10 */
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+		&&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,	/* 0x20 */
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+		&&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,	/* 0x30 */
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+		&&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,	/* 0x40 */
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+		&&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,	/* 0x50 */
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+		&&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,	/* 0x60 */
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+		&&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,	/* 0x70 */
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+		&&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,	/* 0x80 */
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+		&&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,	/* 0x90 */
+		&&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+		&&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,	/* 0xA0 */
+		&&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+		&&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,	/* 0xB0 */
+		&&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+		&&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,	/* 0xC0 */
+		&&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_invalid, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+		&&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_invalid, &&op_0xDC, &&op_invalid, &&op_0xDE, &&op_0xDF,	/* 0xD0 */
+		&&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_invalid, &&op_invalid, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+		&&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_invalid, &&op_invalid, &&op_invalid, &&op_0xEE, &&op_0xEF,	/* 0xE0 */
+		&&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_invalid, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+		&&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_invalid, &&op_invalid, &&op_0xFE, &&op_0xFF	/* 0xF0 */
+		/* *INDENT-ON* */
+	};
+
+	/* Each handler ends by fetching the next opcode and jumping straight
+	 * to its handler, so that every handler has its own indirect branch
+	 * for the branch predictor to learn. */
+#	define OPCODE(op)	op_##op
+#	define OPCODE_INVALID	op_invalid
+#	define NEXT							\
+	do {								\
+		gb->counter.cycles += inst_cycles;		\
+		if(gb->counter.cycles >=			\
+				gb->counter.event_cycles)	\
+			goto done;					\
+		FETCH;							\
+		goto *dispatch[opcode];					\
+	} while(0)
+
+	/* Obtain opcode */
+	FETCH;
+	goto *dispatch[opcode];
+	{
+#else
+#	define OPCODE(op)	case op
+#	define OPCODE_INVALID	default
+#	define NEXT		break
+
+	do {
 	/* Obtain opcode */
-	opcode = (peanut_exec_gb->gb_halt ? 0x00 : __gb_cpu_read($PC++));
-	inst_cycles = op_cycles[opcode];
+	FETCH;
 
 	/* Execute opcode */
 	switch(opcode)
 	{
-	case 0x00: /* NOP */
-		break;
+#endif
+	OPCODE(0x00): /* NOP */
+		NEXT;
 
-	case 0x01: /* LD BC, imm */
-		SET_REG_C(__gb_cpu_read($PC++))
-		SET_REG_B(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x01): /* LD BC, imm */
+		$BC = IMM16;
+		NEXT;
 
-	case 0x02: /* LD (BC), A */
-		__gb_cpu_write(regs->bc, $A);
-		break;
+	OPCODE(0x02): /* LD (BC), A */
+		__gb_cpu_write(gb, $BC, $A);
+		NEXT;
 
-	case 0x03: /* INC BC */
-		regs->bc++;
-		break;
+	OPCODE(0x03): /* INC BC */
+		$BC++;
+		NEXT;
 
-	case 0x04: /* INC B */
-		SET_REG_B(GET_REG_B()+1);
-		SET_REGF_Z((GET_REG_B() == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(((GET_REG_B() & 0x0F) == 0x00))
-		break;
+	OPCODE(0x04): /* INC B */
+		SET_REG_B(__gb_inc8(regs, GET_REG_B()))
+		NEXT;
 
-	case 0x05: /* DEC B */
-		SET_REG_B(GET_REG_B()-1);
-		SET_REGF_Z((GET_REG_B() == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H(((GET_REG_B() & 0x0F) == 0x0F))
-		break;
+	OPCODE(0x05): /* DEC B */
+		SET_REG_B(__gb_dec8(regs, GET_REG_B()))
+		NEXT;
 
-	case 0x06: /* LD B, imm */
-		SET_REG_B(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x06): /* LD B, imm */
+		SET_REG_B(IMM8)
+		NEXT;
 
-	case 0x07: /* RLCA */
+	OPCODE(0x07): /* RLCA */
 		$A = ($A << 1) | ($A >> 7);
 		SET_REGF_Z(0)
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(($A & 0x01))
-		break;
+		NEXT;
 
-	case 0x08: /* LD (imm), SP */
+	OPCODE(0x08): /* LD (imm), SP */
 	{
-		uint16_t temp = __gb_cpu_read($PC++);
-		temp |= __gb_cpu_read($PC++) << 8;
-		__gb_cpu_write(temp++, regs->sp & 0xFF);
-		__gb_cpu_write(temp, regs->sp >> 8);
-		break;
+		/* Low byte first, unlike PUSH, which matters for writes to MBC
+		 * or IO registers. */
+		__gb_cpu_write(gb, IMM16, $SP & 0xFF);
+		__gb_cpu_write(gb, IMM16 + 1, $SP >> 8);
+		NEXT;
 	}
 
-	case 0x09: /* ADD HL, BC */
+	OPCODE(0x09): /* ADD HL, BC */
 	{
-		__gb_add16(regs, regs->bc);
-		break;
+		__gb_add16(regs, $BC);
+		NEXT;
 	}
 
-	case 0x0A: /* LD A, (BC) */
-		$A = __gb_cpu_read(regs->bc);
-		break;
+	OPCODE(0x0A): /* LD A, (BC) */
+		$A = __gb_cpu_read(gb, $BC);
+		NEXT;
 
-	case 0x0B: /* DEC BC */
-		regs->bc--;
-		break;
+	OPCODE(0x0B): /* DEC BC */
+		$BC--;
+		NEXT;
 
-	case 0x0C: /* INC C */
-		SET_REG_C(GET_REG_C()+1);
-		SET_REGF_Z((GET_REG_C() == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(((GET_REG_C() & 0x0F) == 0x00))
-		break;
+	OPCODE(0x0C): /* INC C */
+		SET_REG_C(__gb_inc8(regs, GET_REG_C()))
+		NEXT;
 
-	case 0x0D: /* DEC C */
-		SET_REG_C(GET_REG_C()-1);
-		SET_REGF_Z((GET_REG_C() == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H(((GET_REG_C() & 0x0F) == 0x0F))
-		break;
+	OPCODE(0x0D): /* DEC C */
+		SET_REG_C(__gb_dec8(regs, GET_REG_C()))
+		NEXT;
 
-	case 0x0E: /* LD C, imm */
-		SET_REG_C(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x0E): /* LD C, imm */
+		SET_REG_C(IMM8)
+		NEXT;
 
-	case 0x0F: /* RRCA */
+	OPCODE(0x0F): /* RRCA */
 		SET_REGF_C($A & 0x01)
 		$A = ($A >> 1) | ($A << 7);
 		SET_REGF_Z(0)
-		SET_REGF_N(0)
-		SET_REGF_H(0)
-		break;
+		SET_RESULT_NH(0, 0)
+		NEXT;
 
-	case 0x10: /* STOP */
-		//peanut_exec_gb->gb_halt = 1;
-		break;
+	OPCODE(0x10): /* STOP */
+		//gb->gb_halt = 1;
+		NEXT;
 
-	case 0x11: /* LD DE, imm */
-		SET_REG_E(__gb_cpu_read($PC++))
-		SET_REG_D(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x11): /* LD DE, imm */
+		$DE = IMM16;
+		NEXT;
 
-	case 0x12: /* LD (DE), A */
-		__gb_cpu_write(regs->de, $A);
-		break;
+	OPCODE(0x12): /* LD (DE), A */
+		__gb_cpu_write(gb, $DE, $A);
+		NEXT;
 
-	case 0x13: /* INC DE */
-		regs->de++;
-		break;
+	OPCODE(0x13): /* INC DE */
+		$DE++;
+		NEXT;
 
-	case 0x14: /* INC D */
-		SET_REG_D(GET_REG_D()+1);
-		SET_REGF_Z((GET_REG_D() == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(((GET_REG_D() & 0x0F) == 0x00))
-		break;
+	OPCODE(0x14): /* INC D */
+		SET_REG_D(__gb_inc8(regs, GET_REG_D()))
+		NEXT;
 
-	case 0x15: /* DEC D */
-		SET_REG_D(GET_REG_D()-1);
-		SET_REGF_Z((GET_REG_D() == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H(((GET_REG_D() & 0x0F) == 0x0F))
-		break;
+	OPCODE(0x15): /* DEC D */
+		SET_REG_D(__gb_dec8(regs, GET_REG_D()))
+		NEXT;
 
-	case 0x16: /* LD D, imm */
-		SET_REG_D(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x16): /* LD D, imm */
+		SET_REG_D(IMM8)
+		NEXT;
 
-	case 0x17: /* RLA */
+	OPCODE(0x17): /* RLA */
 	{
 		uint8_t temp = $A;
 		$A = ($A << 1) | GET_REGF_C();
 		SET_REGF_Z(0)
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C((temp >> 7) & 0x01)
-		break;
+		NEXT;
 	}
 
-	case 0x18: /* JR imm */
+	OPCODE(0x18): /* JR imm */
 	{
-		int8_t temp = (int8_t) __gb_cpu_read($PC++);
+		int8_t temp = (int8_t) IMM8;
 		$PC += temp;
-		break;
+		IDLE_LOOP_CHECK(temp)
+		NEXT;
 	}
 
-	case 0x19: /* ADD HL, DE */
+	OPCODE(0x19): /* ADD HL, DE */
 	{
-		__gb_add16(regs, regs->de);
-		break;
+		__gb_add16(regs, $DE);
+		NEXT;
 	}
 
-	case 0x1A: /* LD A, (DE) */
-		$A = __gb_cpu_read(regs->de);
-		break;
+	OPCODE(0x1A): /* LD A, (DE) */
+		$A = __gb_cpu_read(gb, $DE);
+		NEXT;
 
-	case 0x1B: /* DEC DE */
-		regs->de--;
-		break;
+	OPCODE(0x1B): /* DEC DE */
+		$DE--;
+		NEXT;
 
-	case 0x1C: /* INC E */
-		GET_REG_E()++;
-		SET_REGF_Z((GET_REG_E() == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(((GET_REG_E() & 0x0F) == 0x00))
-		break;
+	OPCODE(0x1C): /* INC E */
+		SET_REG_E(__gb_inc8(regs, GET_REG_E()))
+		NEXT;
 
-	case 0x1D: /* DEC E */
-		SET_REG_E(GET_REG_E()-1);
-		SET_REGF_Z((GET_REG_E() == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H(((GET_REG_E() & 0x0F) == 0x0F))
-		break;
+	OPCODE(0x1D): /* DEC E */
+		SET_REG_E(__gb_dec8(regs, GET_REG_E()))
+		NEXT;
 
-	case 0x1E: /* LD E, imm */
-		SET_REG_E(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x1E): /* LD E, imm */
+		SET_REG_E(IMM8)
+		NEXT;
 
-	case 0x1F: /* RRA */
+	OPCODE(0x1F): /* RRA */
 	{
 		uint8_t temp = $A;
 		$A = $A >> 1 | (GET_REGF_C() << 7);
 		SET_REGF_Z(0)
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(temp & 0x1)
-		break;
+		NEXT;
 	}
 
-	case 0x20: /* JP NZ, imm */
+	OPCODE(0x20): /* JP NZ, imm */
 		if(!GET_REGF_Z())
 		{
-			int8_t temp = (int8_t) __gb_cpu_read($PC++);
+			int8_t temp = (int8_t) IMM8;
 			$PC += temp;
 			inst_cycles += 4;
+			IDLE_LOOP_CHECK(temp)
 		}
-		else
-			$PC++;
-
-		break;
+		NEXT;
 
-	case 0x21: /* LD HL, imm */
-		SET_REG_L(__gb_cpu_read($PC++))
-		SET_REG_H(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x21): /* LD HL, imm */
+		$HL = IMM16;
+		NEXT;
 
-	case 0x22: /* LDI (HL), A */
-		__gb_cpu_write($HL, $A);
+	OPCODE(0x22): /* LDI (HL), A */
+		__gb_cpu_write(gb, $HL, $A);
 		$HL++;
-		break;
+		NEXT;
 
-	case 0x23: /* INC HL */
+	OPCODE(0x23): /* INC HL */
 		$HL++;
-		break;
+		NEXT;
 
-	case 0x24: /* INC H */
-		SET_REG_H(GET_REG_H()+1);
-		SET_REGF_Z((GET_REG_H() == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(((GET_REG_H() & 0x0F) == 0x00))
-		break;
+	OPCODE(0x24): /* INC H */
+		SET_REG_H(__gb_inc8(regs, GET_REG_H()))
+		NEXT;
 
-	case 0x25: /* DEC H */
-		SET_REG_H(GET_REG_H()-1);
-		SET_REGF_Z((GET_REG_H() == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H(((GET_REG_H() & 0x0F) == 0x0F))
-		break;
+	OPCODE(0x25): /* DEC H */
+		SET_REG_H(__gb_dec8(regs, GET_REG_H()))
+		NEXT;
 
-	case 0x26: /* LD H, imm */
-		SET_REG_H(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x26): /* LD H, imm */
+		SET_REG_H(IMM8)
+		NEXT;
 
-	case 0x27: /* DAA */
+	OPCODE(0x27): /* DAA */
 	{
 		uint16_t a = $A;
 
@@ -554,1295 +1008,1183 @@ static uint8_t __gb_step_cpu(struct cpu_registers_s *regs)
 			SET_REGF_C(1)
 
 		$A = a;
-		SET_REGF_Z(($A == 0))
+		SET_RESULT_Z($A)
 		SET_REGF_H(0)
 
-		break;
+		NEXT;
 	}
 
-	case 0x28: /* JP Z, imm */
+	OPCODE(0x28): /* JP Z, imm */
 		if(GET_REGF_Z())
 		{
-			int8_t temp = (int8_t) __gb_cpu_read($PC++);
+			int8_t temp = (int8_t) IMM8;
 			$PC += temp;
 			inst_cycles += 4;
+			IDLE_LOOP_CHECK(temp)
 		}
-		else
-			$PC++;
-
-		break;
+		NEXT;
 
-	case 0x29: /* ADD HL, HL */
+	OPCODE(0x29): /* ADD HL, HL */
 	{
 		// TODO: optimize?
 		__gb_add16(regs, $HL);
-		break;
+		NEXT;
 	}
 
-	case 0x2A: /* LD A, (HL+) */
-		$A = __gb_cpu_read($HL++);
-		break;
+	OPCODE(0x2A): /* LD A, (HL+) */
+		$A = __gb_cpu_read(gb, $HL++);
+		NEXT;
 
-	case 0x2B: /* DEC HL */
+	OPCODE(0x2B): /* DEC HL */
 		$HL--;
-		break;
+		NEXT;
 
-	case 0x2C: /* INC L */
-		SET_REG_L(GET_REG_L()+1);
-		SET_REGF_Z((GET_REG_L() == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(((GET_REG_L() & 0x0F) == 0x00))
-		break;
+	OPCODE(0x2C): /* INC L */
+		SET_REG_L(__gb_inc8(regs, GET_REG_L()))
+		NEXT;
 
-	case 0x2D: /* DEC L */
-		SET_REG_L(GET_REG_L()-1);
-		SET_REGF_Z((GET_REG_L() == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H(((GET_REG_L() & 0x0F) == 0x0F))
-		break;
+	OPCODE(0x2D): /* DEC L */
+		SET_REG_L(__gb_dec8(regs, GET_REG_L()))
+		NEXT;
 
-	case 0x2E: /* LD L, imm */
-		SET_REG_L(__gb_cpu_read($PC++))
-		break;
+	OPCODE(0x2E): /* LD L, imm */
+		SET_REG_L(IMM8)
+		NEXT;
 
-	case 0x2F: /* CPL */
+	OPCODE(0x2F): /* CPL */
 		$A = (~$A) & 0xFF;
-		SET_REGF_N(1)
-		SET_REGF_H(1)
-		break;
+		SET_RESULT_NH(1, 0x10)
+		NEXT;
 
-	case 0x30: /* JP NC, imm */
+	OPCODE(0x30): /* JP NC, imm */
 		if(!GET_REGF_C())
 		{
-			int8_t temp = (int8_t) __gb_cpu_read($PC++);
+			int8_t temp = (int8_t) IMM8;
 			$PC += temp;
 			inst_cycles += 4;
+			IDLE_LOOP_CHECK(temp)
 		}
-		else
-			$PC++;
+		NEXT;
 
-		break;
+	OPCODE(0x31): /* LD SP, imm */
+		$SP = IMM16;
+		NEXT;
 
-	case 0x31: /* LD SP, imm */
-		regs->sp = __gb_cpu_read($PC++);
-		regs->sp |= __gb_cpu_read($PC++) << 8;
-		break;
-
-	case 0x32: /* LD (HL), A */
-		__gb_cpu_write($HL, $A);
+	OPCODE(0x32): /* LD (HL), A */
+		__gb_cpu_write(gb, $HL, $A);
 		$HL--;
-		break;
+		NEXT;
 
-	case 0x33: /* INC SP */
-		regs->sp++;
-		break;
+	OPCODE(0x33): /* INC SP */
+		$SP++;
+		NEXT;
 
-	case 0x34: /* INC (HL) */
-	{
-		uint8_t temp = __gb_cpu_read($HL) + 1;
-		SET_REGF_Z((temp == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(((temp & 0x0F) == 0x00))
-		__gb_cpu_write($HL, temp);
-		break;
-	}
+	OPCODE(0x34): /* INC (HL) */
+		__gb_cpu_write(gb, $HL, __gb_inc8(regs, __gb_cpu_read(gb, $HL)));
+		NEXT;
 
-	case 0x35: /* DEC (HL) */
-	{
-		uint8_t temp = __gb_cpu_read($HL) - 1;
-		SET_REGF_Z((temp == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H(((temp & 0x0F) == 0x0F))
-		__gb_cpu_write($HL, temp);
-		break;
-	}
+	OPCODE(0x35): /* DEC (HL) */
+		__gb_cpu_write(gb, $HL, __gb_dec8(regs, __gb_cpu_read(gb, $HL)));
+		NEXT;
 
-	case 0x36: /* LD (HL), imm */
-		__gb_cpu_write($HL, __gb_cpu_read($PC++));
-		break;
+	OPCODE(0x36): /* LD (HL), imm */
+		__gb_cpu_write(gb, $HL, IMM8);
+		NEXT;
 
-	case 0x37: /* SCF */
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+	OPCODE(0x37): /* SCF */
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(1)
-		break;
+		NEXT;
 
-	case 0x38: /* JP C, imm */
+	OPCODE(0x38): /* JP C, imm */
 		if(GET_REGF_C())
 		{
-			int8_t temp = (int8_t) __gb_cpu_read($PC++);
+			int8_t temp = (int8_t) IMM8;
 			$PC += temp;
 			inst_cycles += 4;
+			IDLE_LOOP_CHECK(temp)
 		}
-		else
-			$PC++;
-
-		break;
+		NEXT;
 
-	case 0x39: /* ADD HL, SP */
+	OPCODE(0x39): /* ADD HL, SP */
 	{
-		__gb_add16(regs, regs->sp);
-		break;
+		__gb_add16(regs, $SP);
+		NEXT;
 	}
 
-	case 0x3A: /* LD A, (HL) */
-		$A = __gb_cpu_read($HL--);
-		break;
+	OPCODE(0x3A): /* LD A, (HL) */
+		$A = __gb_cpu_read(gb, $HL--);
+		NEXT;
 
-	case 0x3B: /* DEC SP */
-		regs->sp--;
-		break;
+	OPCODE(0x3B): /* DEC SP */
+		$SP--;
+		NEXT;
 
-	case 0x3C: /* INC A */
-		$A++;
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H((($A & 0x0F) == 0x00))
-		break;
+	OPCODE(0x3C): /* INC A */
+		$A = __gb_inc8(regs, $A);
+		NEXT;
 
-	case 0x3D: /* DEC A */
-		$A--;
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(1)
-		SET_REGF_H((($A & 0x0F) == 0x0F))
-		break;
+	OPCODE(0x3D): /* DEC A */
+		$A = __gb_dec8(regs, $A);
+		NEXT;
 
-	case 0x3E: /* LD A, imm */
-		$A = __gb_cpu_read($PC++);
-		break;
+	OPCODE(0x3E): /* LD A, imm */
+		$A = IMM8;
+		NEXT;
 
-	case 0x3F: /* CCF */
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+	OPCODE(0x3F): /* CCF */
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(!GET_REGF_C())
-		break;
+		NEXT;
 
-	case 0x40: /* LD B, B */
-		break;
+	OPCODE(0x40): /* LD B, B */
+		NEXT;
 
-	case 0x41: /* LD B, C */
+	OPCODE(0x41): /* LD B, C */
 		SET_REG_B(GET_REG_C())
-		break;
+		NEXT;
 
-	case 0x42: /* LD B, D */
+	OPCODE(0x42): /* LD B, D */
 		SET_REG_B(GET_REG_D())
-		break;
+		NEXT;
 
-	case 0x43: /* LD B, E */
+	OPCODE(0x43): /* LD B, E */
 		SET_REG_B(GET_REG_E())
-		break;
+		NEXT;
 
-	case 0x44: /* LD B, H */
+	OPCODE(0x44): /* LD B, H */
 		SET_REG_B(GET_REG_H())
-		break;
+		NEXT;
 
-	case 0x45: /* LD B, L */
+	OPCODE(0x45): /* LD B, L */
 		SET_REG_B(GET_REG_L())
-		break;
+		NEXT;
 
-	case 0x46: /* LD B, (HL) */
-		SET_REG_B(__gb_cpu_read($HL))
-		break;
+	OPCODE(0x46): /* LD B, (HL) */
+		SET_REG_B(__gb_cpu_read(gb, $HL))
+		NEXT;
 
-	case 0x47: /* LD B, A */
+	OPCODE(0x47): /* LD B, A */
 		SET_REG_B($A)
-		break;
+		NEXT;
 
-	case 0x48: /* LD C, B */
+	OPCODE(0x48): /* LD C, B */
 		SET_REG_C(GET_REG_B())
-		break;
+		NEXT;
 
-	case 0x49: /* LD C, C */
-		break;
+	OPCODE(0x49): /* LD C, C */
+		NEXT;
 
-	case 0x4A: /* LD C, D */
+	OPCODE(0x4A): /* LD C, D */
 		SET_REG_C(GET_REG_D())
-		break;
+		NEXT;
 
-	case 0x4B: /* LD C, E */
+	OPCODE(0x4B): /* LD C, E */
 		SET_REG_C(GET_REG_E())
-		break;
+		NEXT;
 
-	case 0x4C: /* LD C, H */
+	OPCODE(0x4C): /* LD C, H */
 		SET_REG_C(GET_REG_H())
-		break;
+		NEXT;
 
-	case 0x4D: /* LD C, L */
+	OPCODE(0x4D): /* LD C, L */
 		SET_REG_C(GET_REG_L())
-		break;
+		NEXT;
 
-	case 0x4E: /* LD C, (HL) */
-		SET_REG_C(__gb_cpu_read($HL))
-		break;
+	OPCODE(0x4E): /* LD C, (HL) */
+		SET_REG_C(__gb_cpu_read(gb, $HL))
+		NEXT;
 
-	case 0x4F: /* LD C, A */
+	OPCODE(0x4F): /* LD C, A */
 		SET_REG_C($A)
-		break;
+		NEXT;
 
-	case 0x50: /* LD D, B */
+	OPCODE(0x50): /* LD D, B */
 		SET_REG_D(GET_REG_B())
-		break;
+		NEXT;
 
-	case 0x51: /* LD D, C */
+	OPCODE(0x51): /* LD D, C */
 		SET_REG_D(GET_REG_C())
-		break;
+		NEXT;
 
-	case 0x52: /* LD D, D */
-		break;
+	OPCODE(0x52): /* LD D, D */
+		NEXT;
 
-	case 0x53: /* LD D, E */
+	OPCODE(0x53): /* LD D, E */
 		SET_REG_D(GET_REG_E())
-		break;
+		NEXT;
 
-	case 0x54: /* LD D, H */
+	OPCODE(0x54): /* LD D, H */
 		SET_REG_D(GET_REG_H())
-		break;
+		NEXT;
 
-	case 0x55: /* LD D, L */
+	OPCODE(0x55): /* LD D, L */
 		SET_REG_D(GET_REG_L())
-		break;
+		NEXT;
 
-	case 0x56: /* LD D, (HL) */
-		SET_REG_D(__gb_cpu_read($HL))
-		break;
+	OPCODE(0x56): /* LD D, (HL) */
+		SET_REG_D(__gb_cpu_read(gb, $HL))
+		NEXT;
 
-	case 0x57: /* LD D, A */
+	OPCODE(0x57): /* LD D, A */
 		SET_REG_D($A)
-		break;
+		NEXT;
 
-	case 0x58: /* LD E, B */
+	OPCODE(0x58): /* LD E, B */
 		SET_REG_E(GET_REG_B())
-		break;
+		NEXT;
 
-	case 0x59: /* LD E, C */
+	OPCODE(0x59): /* LD E, C */
 		SET_REG_E(GET_REG_C())
-		break;
+		NEXT;
 
-	case 0x5A: /* LD E, D */
+	OPCODE(0x5A): /* LD E, D */
 		SET_REG_E(GET_REG_D())
-		break;
+		NEXT;
 
-	case 0x5B: /* LD E, E */
-		break;
+	OPCODE(0x5B): /* LD E, E */
+		NEXT;
 
-	case 0x5C: /* LD E, H */
+	OPCODE(0x5C): /* LD E, H */
 		SET_REG_E(GET_REG_H())
-		break;
+		NEXT;
 
-	case 0x5D: /* LD E, L */
+	OPCODE(0x5D): /* LD E, L */
 		SET_REG_E(GET_REG_L())
-		break;
+		NEXT;
 
-	case 0x5E: /* LD E, (HL) */
-		SET_REG_E(__gb_cpu_read($HL))
-		break;
+	OPCODE(0x5E): /* LD E, (HL) */
+		SET_REG_E(__gb_cpu_read(gb, $HL))
+		NEXT;
 
-	case 0x5F: /* LD E, A */
+	OPCODE(0x5F): /* LD E, A */
 		SET_REG_E($A)
-		break;
+		NEXT;
 
-	case 0x60: /* LD H, B */
+	OPCODE(0x60): /* LD H, B */
 		SET_REG_H(GET_REG_B())
-		break;
+		NEXT;
 
-	case 0x61: /* LD H, C */
+	OPCODE(0x61): /* LD H, C */
 		SET_REG_H(GET_REG_C())
-		break;
+		NEXT;
 
-	case 0x62: /* LD H, D */
+	OPCODE(0x62): /* LD H, D */
 		SET_REG_H(GET_REG_D())
-		break;
+		NEXT;
 
-	case 0x63: /* LD H, E */
+	OPCODE(0x63): /* LD H, E */
 		SET_REG_H(GET_REG_E())
-		break;
+		NEXT;
 
-	case 0x64: /* LD H, H */
-		break;
+	OPCODE(0x64): /* LD H, H */
+		NEXT;
 
-	case 0x65: /* LD H, L */
+	OPCODE(0x65): /* LD H, L */
 		SET_REG_H(GET_REG_L())
-		break;
+		NEXT;
 
-	case 0x66: /* LD H, (HL) */
-		SET_REG_H(__gb_cpu_read($HL))
-		break;
+	OPCODE(0x66): /* LD H, (HL) */
+		SET_REG_H(__gb_cpu_read(gb, $HL))
+		NEXT;
 
-	case 0x67: /* LD H, A */
+	OPCODE(0x67): /* LD H, A */
 		SET_REG_H($A)
-		break;
+		NEXT;
 
-	case 0x68: /* LD L, B */
+	OPCODE(0x68): /* LD L, B */
 		SET_REG_L(GET_REG_B())
-		break;
+		NEXT;
 
-	case 0x69: /* LD L, C */
+	OPCODE(0x69): /* LD L, C */
 		SET_REG_L(GET_REG_C())
-		break;
+		NEXT;
 
-	case 0x6A: /* LD L, D */
+	OPCODE(0x6A): /* LD L, D */
 		SET_REG_L(GET_REG_D())
-		break;
+		NEXT;
 
-	case 0x6B: /* LD L, E */
+	OPCODE(0x6B): /* LD L, E */
 		SET_REG_L(GET_REG_E())
-		break;
+		NEXT;
 
-	case 0x6C: /* LD L, H */
+	OPCODE(0x6C): /* LD L, H */
 		SET_REG_L(GET_REG_H())
-		break;
+		NEXT;
 
-	case 0x6D: /* LD L, L */
-		break;
+	OPCODE(0x6D): /* LD L, L */
+		NEXT;
 
-	case 0x6E: /* LD L, (HL) */
-		SET_REG_L(__gb_cpu_read($HL))
-		break;
+	OPCODE(0x6E): /* LD L, (HL) */
+		SET_REG_L(__gb_cpu_read(gb, $HL))
+		NEXT;
 
-	case 0x6F: /* LD L, A */
+	OPCODE(0x6F): /* LD L, A */
 		SET_REG_L($A)
-		break;
+		NEXT;
 
-	case 0x70: /* LD (HL), B */
-		__gb_cpu_write($HL, GET_REG_B());
-		break;
+	OPCODE(0x70): /* LD (HL), B */
+		__gb_cpu_write(gb, $HL, GET_REG_B());
+		NEXT;
 
-	case 0x71: /* LD (HL), C */
-		__gb_cpu_write($HL, GET_REG_C());
-		break;
+	OPCODE(0x71): /* LD (HL), C */
+		__gb_cpu_write(gb, $HL, GET_REG_C());
+		NEXT;
 
-	case 0x72: /* LD (HL), D */
-		__gb_cpu_write($HL, GET_REG_D());
-		break;
+	OPCODE(0x72): /* LD (HL), D */
+		__gb_cpu_write(gb, $HL, GET_REG_D());
+		NEXT;
 
-	case 0x73: /* LD (HL), E */
-		__gb_cpu_write($HL, GET_REG_E());
-		break;
+	OPCODE(0x73): /* LD (HL), E */
+		__gb_cpu_write(gb, $HL, GET_REG_E());
+		NEXT;
 
-	case 0x74: /* LD (HL), H */
-		__gb_cpu_write($HL, GET_REG_H());
-		break;
+	OPCODE(0x74): /* LD (HL), H */
+		__gb_cpu_write(gb, $HL, GET_REG_H());
+		NEXT;
 
-	case 0x75: /* LD (HL), L */
-		__gb_cpu_write($HL, GET_REG_L());
-		break;
+	OPCODE(0x75): /* LD (HL), L */
+		__gb_cpu_write(gb, $HL, GET_REG_L());
+		NEXT;
 
-	case 0x76: /* HALT */
+	OPCODE(0x76): /* HALT */
 		/* TODO: Emulate HALT bug? */
-		peanut_exec_gb->gb_halt = 1;
-		break;
+		gb->gb_halt = 1;
+		/* HALT is handled by __gb_step. */
+		gb->counter.event_cycles = 0;
+		NEXT;
 
-	case 0x77: /* LD (HL), A */
-		__gb_cpu_write($HL, $A);
-		break;
+	OPCODE(0x77): /* LD (HL), A */
+		__gb_cpu_write(gb, $HL, $A);
+		NEXT;
 
-	case 0x78: /* LD A, B */
+	OPCODE(0x78): /* LD A, B */
 		$A = GET_REG_B();
-		break;
+		NEXT;
 
-	case 0x79: /* LD A, C */
+	OPCODE(0x79): /* LD A, C */
 		$A = GET_REG_C();
-		break;
+		NEXT;
 
-	case 0x7A: /* LD A, D */
+	OPCODE(0x7A): /* LD A, D */
 		$A = GET_REG_D();
-		break;
+		NEXT;
 
-	case 0x7B: /* LD A, E */
+	OPCODE(0x7B): /* LD A, E */
 		$A = GET_REG_E();
-		break;
+		NEXT;
 
-	case 0x7C: /* LD A, H */
+	OPCODE(0x7C): /* LD A, H */
 		$A = GET_REG_H();
-		break;
+		NEXT;
 
-	case 0x7D: /* LD A, L */
+	OPCODE(0x7D): /* LD A, L */
 		$A = GET_REG_L();
-		break;
+		NEXT;
 
-	case 0x7E: /* LD A, (HL) */
-		$A = __gb_cpu_read($HL);
-		break;
+	OPCODE(0x7E): /* LD A, (HL) */
+		$A = __gb_cpu_read(gb, $HL);
+		NEXT;
 
-	case 0x7F: /* LD A, A */
-		break;
+	OPCODE(0x7F): /* LD A, A */
+		NEXT;
 
-	case 0x80: /* ADD A, B */
+	OPCODE(0x80): /* ADD A, B */
 	{
 		__gb_add8(regs, 0, GET_REG_B());
-		break;
+		NEXT;
 	}
 
-	case 0x81: /* ADD A, C */
+	OPCODE(0x81): /* ADD A, C */
 	{
 		__gb_add8(regs, 0, GET_REG_C());
-		break;
+		NEXT;
 	}
 
-	case 0x82: /* ADD A, D */
+	OPCODE(0x82): /* ADD A, D */
 	{
 		__gb_add8(regs, 0, GET_REG_D());
-		break;
+		NEXT;
 	}
 
-	case 0x83: /* ADD A, E */
+	OPCODE(0x83): /* ADD A, E */
 	{
 		__gb_add8(regs, 0, GET_REG_E());
-		break;
+		NEXT;
 	}
 
-	case 0x84: /* ADD A, H */
+	OPCODE(0x84): /* ADD A, H */
 	{
 		__gb_add8(regs, 0, GET_REG_H());
-		break;
+		NEXT;
 	}
 
-	case 0x85: /* ADD A, L */
+	OPCODE(0x85): /* ADD A, L */
 	{
 		__gb_add8(regs, 0, GET_REG_L());
-		break;
+		NEXT;
 	}
 
-	case 0x86: /* ADD A, (HL) */
+	OPCODE(0x86): /* ADD A, (HL) */
 	{
-		uint8_t val = __gb_cpu_read($HL);
+		uint8_t val = __gb_cpu_read(gb, $HL);
 		__gb_add8(regs, 0, val);
-		break;
+		NEXT;
 	}
 
-	case 0x87: /* ADD A, A */
+	OPCODE(0x87): /* ADD A, A */
 	{
 		// TODO: optimize?
 		__gb_add8(regs, 0, $A);
-		break;
+		NEXT;
 	}
 
-	case 0x88: /* ADC A, B */
+	OPCODE(0x88): /* ADC A, B */
 	{
 		__gb_add8(regs, 1, GET_REG_B());
-		break;
+		NEXT;
 	}
 
-	case 0x89: /* ADC A, C */
+	OPCODE(0x89): /* ADC A, C */
 	{
 		__gb_add8(regs, 1, GET_REG_C());
-		break;
+		NEXT;
 	}
 
-	case 0x8A: /* ADC A, D */
+	OPCODE(0x8A): /* ADC A, D */
 	{
 		__gb_add8(regs, 1, GET_REG_D());
-		break;
+		NEXT;
 	}
 
-	case 0x8B: /* ADC A, E */
+	OPCODE(0x8B): /* ADC A, E */
 	{
 		__gb_add8(regs, 1, GET_REG_E());
-		break;
+		NEXT;
 	}
 
-	case 0x8C: /* ADC A, H */
+	OPCODE(0x8C): /* ADC A, H */
 	{
 		__gb_add8(regs, 1, GET_REG_H());
-		break;
+		NEXT;
 	}
 
-	case 0x8D: /* ADC A, L */
+	OPCODE(0x8D): /* ADC A, L */
 	{
 		__gb_add8(regs, 1, GET_REG_L());
-		break;
+		NEXT;
 	}
 
-	case 0x8E: /* ADC A, (HL) */
+	OPCODE(0x8E): /* ADC A, (HL) */
 	{
-		uint8_t val = __gb_cpu_read($HL);
+		uint8_t val = __gb_cpu_read(gb, $HL);
 		__gb_add8(regs, 1, val);
-		break;
+		NEXT;
 	}
 
-	case 0x8F: /* ADC A, A */
+	OPCODE(0x8F): /* ADC A, A */
 	{
 		// TODO: optimize?
 		__gb_add8(regs, 1, $A);
-		break;
+		NEXT;
 	}
 
-	case 0x90: /* SUB B */
+	OPCODE(0x90): /* SUB B */
 	{
 		__gb_sub8(regs, 0, GET_REG_B());
-		break;
+		NEXT;
 	}
 
-	case 0x91: /* SUB C */
+	OPCODE(0x91): /* SUB C */
 	{
 		__gb_sub8(regs, 0, GET_REG_C());
-		break;
+		NEXT;
 	}
 
-	case 0x92: /* SUB D */
+	OPCODE(0x92): /* SUB D */
 	{
 		__gb_sub8(regs, 0, GET_REG_D());
-		break;
+		NEXT;
 	}
 
-	case 0x93: /* SUB E */
+	OPCODE(0x93): /* SUB E */
 	{
 		__gb_sub8(regs, 0, GET_REG_E());
-		break;
+		NEXT;
 	}
 
-	case 0x94: /* SUB H */
+	OPCODE(0x94): /* SUB H */
 	{
 		__gb_sub8(regs, 0, GET_REG_H());
-		break;
+		NEXT;
 	}
 
-	case 0x95: /* SUB L */
+	OPCODE(0x95): /* SUB L */
 	{
 		__gb_sub8(regs, 0, GET_REG_L());
-		break;
+		NEXT;
 	}
 
-	case 0x96: /* SUB (HL) */
+	OPCODE(0x96): /* SUB (HL) */
 	{
-		uint8_t val = __gb_cpu_read($HL);
+		uint8_t val = __gb_cpu_read(gb, $HL);
 		__gb_sub8(regs, 0, val);
-		break;
+		NEXT;
 	}
 
-	case 0x97: /* SUB A */
+	OPCODE(0x97): /* SUB A */
 		$A = 0;
 		SET_REGF_Z(1)
-		SET_REGF_N(1)
-		SET_REGF_H(0)
+		SET_RESULT_NH(1, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0x98: /* SBC A, B */
+	OPCODE(0x98): /* SBC A, B */
 	{
 		__gb_sub8(regs, 1, GET_REG_B());
-		break;
+		NEXT;
 	}
 
-	case 0x99: /* SBC A, C */
+	OPCODE(0x99): /* SBC A, C */
 	{
 		__gb_sub8(regs, 1, GET_REG_C());
-		break;
+		NEXT;
 	}
 
-	case 0x9A: /* SBC A, D */
+	OPCODE(0x9A): /* SBC A, D */
 	{
 		__gb_sub8(regs, 1, GET_REG_D());
-		break;
+		NEXT;
 	}
 
-	case 0x9B: /* SBC A, E */
+	OPCODE(0x9B): /* SBC A, E */
 	{
 		__gb_sub8(regs, 1, GET_REG_E());
-		break;
+		NEXT;
 	}
 
-	case 0x9C: /* SBC A, H */
+	OPCODE(0x9C): /* SBC A, H */
 	{
 		__gb_sub8(regs, 1, GET_REG_H());
-		break;
+		NEXT;
 	}
 
-	case 0x9D: /* SBC A, L */
+	OPCODE(0x9D): /* SBC A, L */
 	{
 		__gb_sub8(regs, 1, GET_REG_L());
-		break;
+		NEXT;
 	}
 
-	case 0x9E: /* SBC A, (HL) */
+	OPCODE(0x9E): /* SBC A, (HL) */
 	{
-		uint8_t val = __gb_cpu_read($HL);
+		uint8_t val = __gb_cpu_read(gb, $HL);
 		__gb_sub8(regs, 1, val);
-		break;
+		NEXT;
 	}
 
-	case 0x9F: /* SBC A, A */
+	OPCODE(0x9F): /* SBC A, A */
 		$A = GET_REGF_C() ? 0xFF : 0x00;
 		SET_REGF_Z(GET_REGF_C() ? 0x00 : 0x01)
 		SET_REGF_N(1)
 		SET_REGF_H(GET_REGF_C())
-		break;
+		NEXT;
 
-	case 0xA0: /* AND B */
+	OPCODE(0xA0): /* AND B */
 		$A = $A & GET_REG_B();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA1: /* AND C */
+	OPCODE(0xA1): /* AND C */
 		$A = $A & GET_REG_C();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA2: /* AND D */
+	OPCODE(0xA2): /* AND D */
 		$A = $A & GET_REG_D();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA3: /* AND E */
+	OPCODE(0xA3): /* AND E */
 		$A = $A & GET_REG_E();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA4: /* AND H */
+	OPCODE(0xA4): /* AND H */
 		$A = $A & GET_REG_H();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA5: /* AND L */
+	OPCODE(0xA5): /* AND L */
 		$A = $A & GET_REG_L();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA6: /* AND B */
-		$A = $A & __gb_cpu_read($HL);
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+	OPCODE(0xA6): /* AND B */
+		$A = $A & __gb_cpu_read(gb, $HL);
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA7: /* AND A */
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+	OPCODE(0xA7): /* AND A */
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA8: /* XOR B */
+	OPCODE(0xA8): /* XOR B */
 		$A = $A ^ GET_REG_B();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xA9: /* XOR C */
+	OPCODE(0xA9): /* XOR C */
 		$A = $A ^ GET_REG_C();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xAA: /* XOR D */
+	OPCODE(0xAA): /* XOR D */
 		$A = $A ^ GET_REG_D();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xAB: /* XOR E */
+	OPCODE(0xAB): /* XOR E */
 		$A = $A ^ GET_REG_E();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xAC: /* XOR H */
+	OPCODE(0xAC): /* XOR H */
 		$A = $A ^ GET_REG_H();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xAD: /* XOR L */
+	OPCODE(0xAD): /* XOR L */
 		$A = $A ^ GET_REG_L();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xAE: /* XOR (HL) */
-		$A = $A ^ __gb_cpu_read($HL);
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+	OPCODE(0xAE): /* XOR (HL) */
+		$A = $A ^ __gb_cpu_read(gb, $HL);
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xAF: /* XOR A */
+	OPCODE(0xAF): /* XOR A */
 		$A = 0x00;
 		SET_REGF_Z(1)
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB0: /* OR B */
+	OPCODE(0xB0): /* OR B */
 		$A = $A | GET_REG_B();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB1: /* OR C */
+	OPCODE(0xB1): /* OR C */
 		$A = $A | GET_REG_C();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB2: /* OR D */
+	OPCODE(0xB2): /* OR D */
 		$A = $A | GET_REG_D();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB3: /* OR E */
+	OPCODE(0xB3): /* OR E */
 		$A = $A | GET_REG_E();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB4: /* OR H */
+	OPCODE(0xB4): /* OR H */
 		$A = $A | GET_REG_H();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB5: /* OR L */
+	OPCODE(0xB5): /* OR L */
 		$A = $A | GET_REG_L();
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB6: /* OR (HL) */
-		$A = $A | __gb_cpu_read($HL);
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+	OPCODE(0xB6): /* OR (HL) */
+		$A = $A | __gb_cpu_read(gb, $HL);
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB7: /* OR A */
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+	OPCODE(0xB7): /* OR A */
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xB8: /* CP B */
+	OPCODE(0xB8): /* CP B */
 	{
 		__gb_cmp8(regs, 0, GET_REG_B());
-		break;
+		NEXT;
 	}
 
-	case 0xB9: /* CP C */
+	OPCODE(0xB9): /* CP C */
 	{
 		__gb_cmp8(regs, 0, GET_REG_C());
-		break;
+		NEXT;
 	}
 
-	case 0xBA: /* CP D */
+	OPCODE(0xBA): /* CP D */
 	{
 		__gb_cmp8(regs, 0, GET_REG_D());
-		break;
+		NEXT;
 	}
 
-	case 0xBB: /* CP E */
+	OPCODE(0xBB): /* CP E */
 	{
 		__gb_cmp8(regs, 0, GET_REG_E());
-		break;
+		NEXT;
 	}
 
-	case 0xBC: /* CP H */
+	OPCODE(0xBC): /* CP H */
 	{
 		__gb_cmp8(regs, 0, GET_REG_H());
-		break;
+		NEXT;
 	}
 
-	case 0xBD: /* CP L */
+	OPCODE(0xBD): /* CP L */
 	{
 		__gb_cmp8(regs, 0, GET_REG_L());
-		break;
+		NEXT;
 	}
 
 	/* TODO: Optimsation by combining similar opcode routines. */
-	case 0xBE: /* CP (HL) */
+	OPCODE(0xBE): /* CP (HL) */
 	{
-		uint8_t val = __gb_cpu_read($HL);
+		uint8_t val = __gb_cpu_read(gb, $HL);
 		__gb_cmp8(regs, 0, val);
-		break;
+		NEXT;
 	}
 
-	case 0xBF: /* CP A */
+	OPCODE(0xBF): /* CP A */
 		SET_REGF_Z(1)
-		SET_REGF_N(1)
-		SET_REGF_H(0)
+		SET_RESULT_NH(1, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xC0: /* RET NZ */
+	OPCODE(0xC0): /* RET NZ */
 		if(!GET_REGF_Z())
 		{
-			$PC = __gb_cpu_read(regs->sp++);
-			$PC |= __gb_cpu_read(regs->sp++) << 8;
+			$PC = __gb_pop16(gb, regs);
 			inst_cycles += 12;
 		}
+		NEXT;
 
-		break;
-
-	case 0xC1: /* POP BC */
-		SET_REG_C(__gb_cpu_read(regs->sp++))
-		SET_REG_B(__gb_cpu_read(regs->sp++))
-		break;
+	OPCODE(0xC1): /* POP BC */
+		$BC = __gb_pop16(gb, regs);
+		NEXT;
 
-	case 0xC2: /* JP NZ, imm */
+	OPCODE(0xC2): /* JP NZ, imm */
 		if(!GET_REGF_Z())
 		{
-			uint16_t temp = __gb_cpu_read($PC++);
-			temp |= __gb_cpu_read($PC++) << 8;
+			uint16_t temp = IMM16;
 			$PC = temp;
 			inst_cycles += 4;
 		}
-		else
-			$PC += 2;
+		NEXT;
 
-		break;
-
-	case 0xC3: /* JP imm */
+	OPCODE(0xC3): /* JP imm */
 	{
-		uint16_t temp = __gb_cpu_read($PC++);
-		temp |= __gb_cpu_read($PC) << 8;
-		$PC = temp;
-		break;
+		$PC = IMM16;
+		NEXT;
 	}
 
-	case 0xC4: /* CALL NZ imm */
+	OPCODE(0xC4): /* CALL NZ imm */
 		if(!GET_REGF_Z())
 		{
-			uint16_t temp = __gb_cpu_read($PC++);
-			temp |= __gb_cpu_read($PC++) << 8;
-			__gb_cpu_write(--regs->sp, $PC >> 8);
-			__gb_cpu_write(--regs->sp, $PC & 0xFF);
+			uint16_t temp = IMM16;
+			__gb_push16(gb, regs, $PC);
 			$PC = temp;
 			inst_cycles += 12;
 		}
-		else
-			$PC += 2;
-
-		break;
+		NEXT;
 
-	case 0xC5: /* PUSH BC */
-		__gb_cpu_write(--regs->sp, GET_REG_B());
-		__gb_cpu_write(--regs->sp, GET_REG_C());
-		break;
+	OPCODE(0xC5): /* PUSH BC */
+		__gb_push16(gb, regs, $BC);
+		NEXT;
 
-	case 0xC6: /* ADD A, imm */
+	OPCODE(0xC6): /* ADD A, imm */
 	{
-		uint8_t value = __gb_cpu_read($PC++);
+		uint8_t value = IMM8;
 		__gb_add8(regs, 0, value);
-		break;
+		NEXT;
 	}
 
-	case 0xC7: /* RST 0x0000 */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xC7): /* RST 0x0000 */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0000;
-		break;
+		NEXT;
 
-	case 0xC8: /* RET Z */
+	OPCODE(0xC8): /* RET Z */
 		if(GET_REGF_Z())
 		{
-			uint16_t temp = __gb_cpu_read(regs->sp++);
-			temp |= __gb_cpu_read(regs->sp++) << 8;
+			uint16_t temp = __gb_pop16(gb, regs);
 			$PC = temp;
 			inst_cycles += 12;
 		}
+		NEXT;
 
-		break;
-
-	case 0xC9: /* RET */
+	OPCODE(0xC9): /* RET */
 	{
-		uint16_t temp = __gb_cpu_read(regs->sp++);
-		temp |= __gb_cpu_read(regs->sp++) << 8;
+		uint16_t temp = __gb_pop16(gb, regs);
 		$PC = temp;
-		break;
+		NEXT;
 	}
 
-	case 0xCA: /* JP Z, imm */
+	OPCODE(0xCA): /* JP Z, imm */
 		if(GET_REGF_Z())
 		{
-			uint16_t temp = __gb_cpu_read($PC++);
-			temp |= __gb_cpu_read($PC++) << 8;
+			uint16_t temp = IMM16;
 			$PC = temp;
 			inst_cycles += 4;
 		}
-		else
-			$PC += 2;
-
-		break;
+		NEXT;
 
-	case 0xCB: /* CB INST */
-		inst_cycles = __gb_execute_cb(regs);
-		break;
+	OPCODE(0xCB): /* CB INST */
+		inst_cycles = __gb_execute_cb(gb, regs, IMM8);
+		NEXT;
 
-	case 0xCC: /* CALL Z, imm */
+	OPCODE(0xCC): /* CALL Z, imm */
 		if(GET_REGF_Z())
 		{
-			uint16_t temp = __gb_cpu_read($PC++);
-			temp |= __gb_cpu_read($PC++) << 8;
-			__gb_cpu_write(--regs->sp, $PC >> 8);
-			__gb_cpu_write(--regs->sp, $PC & 0xFF);
+			uint16_t temp = IMM16;
+			__gb_push16(gb, regs, $PC);
 			$PC = temp;
 			inst_cycles += 12;
 		}
-		else
-			$PC += 2;
-
-		break;
+		NEXT;
 
-	case 0xCD: /* CALL imm */
+	OPCODE(0xCD): /* CALL imm */
 	{
-		uint16_t addr = __gb_cpu_read($PC++);
-		addr |= __gb_cpu_read($PC++) << 8;
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+		uint16_t addr = IMM16;
+		__gb_push16(gb, regs, $PC);
 		$PC = addr;
 	}
-	break;
+	NEXT;
 
-	case 0xCE: /* ADC A, imm */
+	OPCODE(0xCE): /* ADC A, imm */
 	{
-		uint8_t value = __gb_cpu_read($PC++);
+		uint8_t value = IMM8;
 		__gb_add8(regs, 1, value);
-		break;
+		NEXT;
 	}
 
-	case 0xCF: /* RST 0x0008 */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xCF): /* RST 0x0008 */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0008;
-		break;
+		NEXT;
 
-	case 0xD0: /* RET NC */
+	OPCODE(0xD0): /* RET NC */
 		if(!GET_REGF_C())
 		{
-			uint16_t temp = __gb_cpu_read(regs->sp++);
-			temp |= __gb_cpu_read(regs->sp++) << 8;
+			uint16_t temp = __gb_pop16(gb, regs);
 			$PC = temp;
 			inst_cycles += 12;
 		}
+		NEXT;
 
-		break;
-
-	case 0xD1: /* POP DE */
-		SET_REG_E(__gb_cpu_read(regs->sp++))
-		SET_REG_D(__gb_cpu_read(regs->sp++))
-		break;
+	OPCODE(0xD1): /* POP DE */
+		$DE = __gb_pop16(gb, regs);
+		NEXT;
 
-	case 0xD2: /* JP NC, imm */
+	OPCODE(0xD2): /* JP NC, imm */
 		if(!GET_REGF_C())
 		{
-			uint16_t temp =  __gb_cpu_read($PC++);
-			temp |=  __gb_cpu_read($PC++) << 8;
+			uint16_t temp = IMM16;
 			$PC = temp;
 			inst_cycles += 4;
 		}
-		else
-			$PC += 2;
-
-		break;
+		NEXT;
 
-	case 0xD4: /* CALL NC, imm */
+	OPCODE(0xD4): /* CALL NC, imm */
 		if(!GET_REGF_C())
 		{
-			uint16_t temp = __gb_cpu_read($PC++);
-			temp |= __gb_cpu_read($PC++) << 8;
-			__gb_cpu_write(--regs->sp, $PC >> 8);
-			__gb_cpu_write(--regs->sp, $PC & 0xFF);
+			uint16_t temp = IMM16;
+			__gb_push16(gb, regs, $PC);
 			$PC = temp;
 			inst_cycles += 12;
 		}
-		else
-			$PC += 2;
+		NEXT;
 
-		break;
+	OPCODE(0xD5): /* PUSH DE */
+		__gb_push16(gb, regs, $DE);
+		NEXT;
 
-	case 0xD5: /* PUSH DE */
-		__gb_cpu_write(--regs->sp, GET_REG_D());
-		__gb_cpu_write(--regs->sp, GET_REG_E());
-		break;
-
-	case 0xD6: /* SUB A, imm */
+	OPCODE(0xD6): /* SUB A, imm */
 	{
-		uint8_t value = __gb_cpu_read($PC++);
+		uint8_t value = IMM8;
 		__gb_sub8(regs, 0, value);
-		break;
+		NEXT;
 	}
 
-	case 0xD7: /* RST 0x0010 */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xD7): /* RST 0x0010 */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0010;
-		break;
+		NEXT;
 
-	case 0xD8: /* RET C */
+	OPCODE(0xD8): /* RET C */
 		if(GET_REGF_C())
 		{
-			uint16_t temp = __gb_cpu_read(regs->sp++);
-			temp |= __gb_cpu_read(regs->sp++) << 8;
+			uint16_t temp = __gb_pop16(gb, regs);
 			$PC = temp;
 			inst_cycles += 12;
 		}
+		NEXT;
 
-		break;
-
-	case 0xD9: /* RETI */
+	OPCODE(0xD9): /* RETI */
 	{
-		uint16_t temp = __gb_cpu_read(regs->sp++);
-		temp |= __gb_cpu_read(regs->sp++) << 8;
+		uint16_t temp = __gb_pop16(gb, regs);
 		$PC = temp;
-		peanut_exec_gb->gb_ime = 1;
+		gb->gb_ime = 1;
+		gb->counter.event_cycles = 0;
 	}
-	break;
+	NEXT;
 
-	case 0xDA: /* JP C, imm */
+	OPCODE(0xDA): /* JP C, imm */
 		if(GET_REGF_C())
 		{
-			uint16_t addr = __gb_cpu_read($PC++);
-			addr |= __gb_cpu_read($PC++) << 8;
+			uint16_t addr = IMM16;
 			$PC = addr;
 			inst_cycles += 4;
 		}
-		else
-			$PC += 2;
-
-		break;
+		NEXT;
 
-	case 0xDC: /* CALL C, imm */
+	OPCODE(0xDC): /* CALL C, imm */
 		if(GET_REGF_C())
 		{
-			uint16_t temp = __gb_cpu_read($PC++);
-			temp |= __gb_cpu_read($PC++) << 8;
-			__gb_cpu_write(--regs->sp, $PC >> 8);
-			__gb_cpu_write(--regs->sp, $PC & 0xFF);
+			uint16_t temp = IMM16;
+			__gb_push16(gb, regs, $PC);
 			$PC = temp;
 			inst_cycles += 12;
 		}
-		else
-			$PC += 2;
-
-		break;
+		NEXT;
 
-	case 0xDE: /* SBC A, imm */
+	OPCODE(0xDE): /* SBC A, imm */
 	{
-		uint8_t value = __gb_cpu_read($PC++);
+		uint8_t value = IMM8;
 		__gb_sub8(regs, 1, value);
-		break;
+		NEXT;
 	}
 
-	case 0xDF: /* RST 0x0018 */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xDF): /* RST 0x0018 */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0018;
-		break;
+		NEXT;
 
-	case 0xE0: /* LD (0xFF00+imm), A */
-		__gb_cpu_write(0xFF00 | __gb_cpu_read($PC++),
-			   $A);
-		break;
+	OPCODE(0xE0): /* LD (0xFF00+imm), A */
+		__gb_write_io(gb, 0xFF00 | IMM8, $A);
+		NEXT;
 
-	case 0xE1: /* POP HL */
-		SET_REG_L(__gb_cpu_read(regs->sp++))
-		SET_REG_H(__gb_cpu_read(regs->sp++))
-		break;
+	OPCODE(0xE1): /* POP HL */
+		$HL = __gb_pop16(gb, regs);
+		NEXT;
 
-	case 0xE2: /* LD (C), A */
-		__gb_cpu_write(0xFF00 | GET_REG_C(), $A);
-		break;
+	OPCODE(0xE2): /* LD (C), A */
+		__gb_write_io(gb, 0xFF00 | GET_REG_C(), $A);
+		NEXT;
 
-	case 0xE5: /* PUSH HL */
-		__gb_cpu_write(--regs->sp, GET_REG_H());
-		__gb_cpu_write(--regs->sp, GET_REG_L());
-		break;
+	OPCODE(0xE5): /* PUSH HL */
+		__gb_push16(gb, regs, $HL);
+		NEXT;
 
-	case 0xE6: /* AND imm */
+	OPCODE(0xE6): /* AND imm */
 		/* TODO: Optimisation? */
-		$A = $A & __gb_cpu_read($PC++);
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(1)
+		$A = $A & IMM8;
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0x10)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xE7: /* RST 0x0020 */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xE7): /* RST 0x0020 */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0020;
-		break;
+		NEXT;
 
-	case 0xE8: /* ADD SP, imm */
+	OPCODE(0xE8): /* ADD SP, imm */
 	{
-		int8_t offset = (int8_t) __gb_cpu_read($PC++);
+		int8_t offset = (int8_t) IMM8;
 		/* TODO: Move flag assignments for optimisation. */
 		SET_REGF_Z(0)
 		SET_REGF_N(0)
-		SET_REGF_H(((regs->sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0)
-		SET_REGF_C(((regs->sp & 0xFF) + (offset & 0xFF) > 0xFF))
-		regs->sp += offset;
-		break;
+		SET_REGF_H((($SP & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0)
+		SET_REGF_C((($SP & 0xFF) + (offset & 0xFF) > 0xFF))
+		$SP += offset;
+		NEXT;
 	}
 
-	case 0xE9: /* JP (HL) */
+	OPCODE(0xE9): /* JP (HL) */
 		$PC = $HL;
-		break;
+		NEXT;
 
-	case 0xEA: /* LD (imm), A */
+	OPCODE(0xEA): /* LD (imm), A */
 	{
-		uint16_t addr = __gb_cpu_read($PC++);
-		addr |= __gb_cpu_read($PC++) << 8;
-		__gb_cpu_write(addr, $A);
-		break;
+		uint16_t addr = IMM16;
+		__gb_cpu_write(gb, addr, $A);
+		NEXT;
 	}
 
-	case 0xEE: /* XOR imm */
-		$A = $A ^ __gb_cpu_read($PC++);
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+	OPCODE(0xEE): /* XOR imm */
+		$A = $A ^ IMM8;
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xEF: /* RST 0x0028 */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xEF): /* RST 0x0028 */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0028;
-		break;
+		NEXT;
 
-	case 0xF0: /* LD A, (0xFF00+imm) */
-		$A =
-			__gb_cpu_read(0xFF00 | __gb_cpu_read($PC++));
-		break;
+	OPCODE(0xF0): /* LD A, (0xFF00+imm) */
+		$A = __gb_read_io(gb, 0xFF00 | IMM8);
+		NEXT;
 
-	case 0xF1: /* POP AF */
+	OPCODE(0xF1): /* POP AF */
 	{
-		uint8_t temp_8 = __gb_cpu_read(regs->sp++);
-		__set_f(regs, temp_8);
-		$A = __gb_cpu_read(regs->sp++);
-		break;
+		uint16_t temp = __gb_pop16(gb, regs);
+		__set_f(regs, temp & 0xFF);
+		$A = temp >> 8;
+		NEXT;
 	}
 
-	case 0xF2: /* LD A, (C) */
-		$A = __gb_cpu_read(0xFF00 | GET_REG_C());
-		break;
+	OPCODE(0xF2): /* LD A, (C) */
+		$A = __gb_read_io(gb, 0xFF00 | GET_REG_C());
+		NEXT;
 
-	case 0xF3: /* DI */
-		peanut_exec_gb->gb_ime = 0;
-		break;
+	OPCODE(0xF3): /* DI */
+		gb->gb_ime = 0;
+		NEXT;
 
-	case 0xF5: /* PUSH AF */
-		__gb_cpu_write(--regs->sp, $A);
-		__gb_cpu_write(--regs->sp, __get_f(regs));
-		break;
+	OPCODE(0xF5): /* PUSH AF */
+		__gb_push16(gb, regs, ($A << 8) | __get_f(regs));
+		NEXT;
 
-	case 0xF6: /* OR imm */
-		$A = $A | __gb_cpu_read($PC++);
-		SET_REGF_Z(($A == 0x00))
-		SET_REGF_N(0)
-		SET_REGF_H(0)
+	OPCODE(0xF6): /* OR imm */
+		$A = $A | IMM8;
+		SET_RESULT_Z($A)
+		SET_RESULT_NH(0, 0)
 		SET_REGF_C(0)
-		break;
+		NEXT;
 
-	case 0xF7: /* PUSH AF */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xF7): /* PUSH AF */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0030;
-		break;
+		NEXT;
 
-	case 0xF8: /* LD HL, SP+/-imm */
+	OPCODE(0xF8): /* LD HL, SP+/-imm */
 	{
 		/* Taken from SameBoy, which is released under MIT Licence. */
-		int8_t offset = (int8_t) __gb_cpu_read($PC++);
-		$HL = regs->sp + offset;
+		int8_t offset = (int8_t) IMM8;
+		$HL = $SP + offset;
 		SET_REGF_Z(0)
 		SET_REGF_N(0)
-		SET_REGF_H(((regs->sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0)
-		SET_REGF_C(((regs->sp & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 : 0);
-		break;
+		SET_REGF_H((($SP & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0)
+		SET_REGF_C((($SP & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 : 0);
+		NEXT;
 	}
 
-	case 0xF9: /* LD SP, HL */
-		regs->sp = $HL;
-		break;
+	OPCODE(0xF9): /* LD SP, HL */
+		$SP = $HL;
+		NEXT;
 
-	case 0xFA: /* LD A, (imm) */
+	OPCODE(0xFA): /* LD A, (imm) */
 	{
-		uint16_t addr = __gb_cpu_read($PC++);
-		addr |= __gb_cpu_read($PC++) << 8;
-		$A = __gb_cpu_read(addr);
-		break;
+		uint16_t addr = IMM16;
+		$A = __gb_cpu_read(gb, addr);
+		NEXT;
 	}
 
-	case 0xFB: /* EI */
-		peanut_exec_gb->gb_ime = 1;
-		break;
+	OPCODE(0xFB): /* EI */
+		gb->gb_ime = 1;
+		gb->counter.event_cycles = 0;
+		NEXT;
 
-	case 0xFE: /* CP imm */
+	OPCODE(0xFE): /* CP imm */
 	{
-		uint8_t value = __gb_cpu_read($PC++);
+		uint8_t value = IMM8;
 		__gb_cmp8(regs, 0, value);
-		break;
+		NEXT;
 	}
 
-	case 0xFF: /* RST 0x0038 */
-		__gb_cpu_write(--regs->sp, $PC >> 8);
-		__gb_cpu_write(--regs->sp, $PC & 0xFF);
+	OPCODE(0xFF): /* RST 0x0038 */
+		__gb_push16(gb, regs, $PC);
 		$PC = 0x0038;
-		break;
+		NEXT;
 	
-	default:
-		(peanut_exec_gb->gb_error)(peanut_exec_gb, GB_INVALID_OPCODE, opcode);
-	}
-	return inst_cycles;
+	OPCODE_INVALID:
+		store_regs(regs);
+		(gb->gb_error)(gb, GB_INVALID_OPCODE, opcode);
+		NEXT;
+	}
+
+#if PEANUT_GB_THREADED_DISPATCH
+done:
+#else
+	gb->counter.cycles += inst_cycles;
+	} while(gb->counter.cycles <
+			gb->counter.event_cycles);
+#endif
+
+#undef OPCODE
+#undef OPCODE_INVALID
+#undef NEXT
+#undef FETCH
+#undef NEXT_BLOCK
+#undef IMM8
+#undef IMM16
 }
 
-uint8_t __gb_step_chunked(struct cpu_registers_s *regs)
+void __gb_run_cpu(struct gb_s *gb)
 {
+	struct cpu_registers_s *regs = &gb->cpu_reg;
+	host_regs_t host;
+
+	save_host_regs(host);
 	load_regs(regs);
-    // take 3 cpu steps at a time
-    uint8_t inst_cycles = 0;
-    for (size_t i = 0; i < CPU_STEP_CHUNK; ++i)
-    {
-        inst_cycles += __gb_step_cpu(regs);
-    }
+	__gb_step_cpu(gb, regs);
 	store_regs(regs);
-    return inst_cycles;
+	restore_host_regs(host);
 }
\ No newline at end of file
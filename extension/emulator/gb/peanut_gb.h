@@ -59,8 +59,26 @@
 #	define ENABLE_SOUND 0
 #endif
 
-// 1 is most accurate. Higher is faster
-#define CPU_STEP_CHUNK 1
+/* Dispatch opcodes through a table of label addresses (a GCC extension)
+ * rather than a switch statement. Off by default: it has not been measured to
+ * be faster than the switch. */
+#ifndef PEANUT_GB_THREADED_DISPATCH
+#	define PEANUT_GB_THREADED_DISPATCH 0
+#endif
+
+/* Keep the emulated CPU registers in host registers while the CPU runs,
+ * using GCC global register variables. All registers but SP are pinned on
+ * ARM; x86-64 has fewer callee-saved registers, and rbp may be needed as the
+ * frame pointer, so BC, DE, HL and SP stay in struct cpu_registers_s. Set to
+ * 0 to keep every register in the struct. */
+#ifndef PEANUT_GB_PINNED_REGS
+#	if defined(__GNUC__) && !defined(__clang__) && \
+		(defined(__arm__) || defined(__x86_64__))
+#		define PEANUT_GB_PINNED_REGS 1
+#	else
+#		define PEANUT_GB_PINNED_REGS 0
+#	endif
+#endif
 
 /* Enable LCD drawing. On by default. May be turned off for testing purposes. */
 #ifndef ENABLE_LCD
@@ -72,6 +90,60 @@
 	#define PEANUT_GB_HIGH_LCD_ACCURACY 1
 #endif
 
+/* Model the time taken by OAM DMA. While a transfer is in progress, the CPU
+ * can only access IO and HRAM. Off by default: the transfer itself is always
+ * done at once, and games wait for it to finish before touching other memory
+ * anyway. */
+#ifndef PEANUT_GB_DMA_TIMING
+	#define PEANUT_GB_DMA_TIMING 0
+#endif
+
+#if PEANUT_GB_DMA_TIMING
+#	define DMA_ACTIVE(gb) ((gb)->counter.dma_count != 0)
+#else
+#	define DMA_ACTIVE(gb) 0
+#endif
+
+/* Skip over loops that poll memory waiting for an event, such as waiting for
+ * LY to reach a given line. Can be disabled per ROM with direct.idle_skip. */
+#ifndef PEANUT_GB_IDLE_LOOP_SKIP
+	#define PEANUT_GB_IDLE_LOOP_SKIP 1
+#endif
+
+/* Number of analysed loops remembered, and the longest loop body (in bytes)
+ * that is considered for skipping. */
+#define IDLE_LOOP_CACHE_SIZE	8
+#define IDLE_LOOP_MAX_LEN	16
+
+/* Cache decoded straight-line runs of ROM code, so that instructions are not
+ * fetched byte by byte through __gb_read. Code outside ROM is still decoded
+ * as it runs. */
+#ifndef PEANUT_GB_BLOCK_CACHE
+	#define PEANUT_GB_BLOCK_CACHE 1
+#endif
+
+/* Run common copy and fill loops in ROM, such as LD A, (HL+); LD (DE), A;
+ * INC DE; DEC BC; LD A, B; OR C; JR NZ, as bulk memory operations. Requires
+ * PEANUT_GB_BLOCK_CACHE. */
+#ifndef PEANUT_GB_LOOP_FUSION
+	#define PEANUT_GB_LOOP_FUSION PEANUT_GB_BLOCK_CACHE
+#endif
+
+/* Alignment of the buffers allocated by gb_init(): the size of a cache line,
+ * which is 32 bytes on the Cortex-M7. */
+#ifndef PEANUT_GB_CACHE_LINE
+#	if defined(__arm__)
+#		define PEANUT_GB_CACHE_LINE 32
+#	else
+#		define PEANUT_GB_CACHE_LINE 64
+#	endif
+#endif
+
+/* Block cache geometry. Each block holds up to BLOCK_MAX_OPS instructions. */
+#define BLOCK_CACHE_SETS	64
+#define BLOCK_CACHE_WAYS	4
+#define BLOCK_MAX_OPS		16
+
 /* Interrupt masks */
 #define VBLANK_INTR	0x01
 #define LCDC_INTR	0x02
@@ -114,6 +186,9 @@
  * 4194304 / (8192 / 8) = 4096 clock cycles for sending 1 byte. */
 #define SERIAL_CYCLES		4096
 
+/* OAM DMA copies one byte per machine cycle. */
+#define DMA_CYCLES		(OAM_SIZE * 4)
+
 /* Calculating VSYNC. */
 #define DMG_CLOCK_FREQ		4194304.0f
 #define SCREEN_REFRESH_CYCLES	70224.0f
@@ -148,6 +223,9 @@
 #define LCD_MODE_2_CYCLES   204
 #define LCD_MODE_3_CYCLES   284
 #define LCD_VERT_LINES      154
+/* Cycles from one VBLANK to the next. While the LCD is off, a frame still
+ * ends after this many cycles. */
+#define LCD_FRAME_CYCLES    (LCD_LINE_CYCLES * LCD_VERT_LINES)
 #define LCD_WIDTH           160
 #define LCD_HEIGHT          144
 
@@ -166,9 +244,21 @@
 #define SERIAL_INTR_ADDR    0x0058
 #define CONTROL_INTR_ADDR   0x0060
 
+/* Tiles in tile data, from VRAM_TILES_1 up to VRAM_BMAP_1. */
+#define NUM_TILES           384
+/* Rows of 32 tiles in both background maps. */
+#define NUM_MAP_ROWS        64
+
 /* SPRITE controls */
 #define NUM_SPRITES         0x28
 #define MAX_SPRITES_LINE    0x0A
+/* Sprites listed for each line. The limit of 10 is only applied with
+ * PEANUT_GB_HIGH_LCD_ACCURACY. */
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+	#define LINE_SPRITES        MAX_SPRITES_LINE
+#else
+	#define LINE_SPRITES        NUM_SPRITES
+#endif
 #define OBJ_PRIORITY        0x80
 #define OBJ_FLIP_Y          0x40
 #define OBJ_FLIP_X          0x20
@@ -176,14 +266,30 @@
 
 #define ROM_HEADER_CHECKSUM_LOC	0x014D
 
+/* Row that a line is not drawn to by gb_set_dither(). */
+#define GB_DITHER_NO_ROW    0xFF
+
 #ifndef MIN
 	#define MIN(a, b)   ((a) < (b) ? (a) : (b))
 #endif
 
 #define PEANUT_GB_ARRAYSIZE(array)    (sizeof(array)/sizeof(array[0]))
 
+/* The order of the first eight members matches the host registers they are
+ * pinned to on ARM, so that they can be loaded with a single ldm. */
 struct cpu_registers_s
 {
+	union
+	{
+		struct
+		{
+			uint8_t c;
+			uint8_t b;
+		};
+		uint16_t bc;
+		uint32_t bc32;
+	};
+
 	union
 	{
 		uint8_t a;
@@ -199,23 +305,6 @@ struct cpu_registers_s
 		uint16_t pc; /* Program counter */
 		uint32_t pc32;
 	};
-	
-	union
-	{
-		uint16_t sp; /* Stack pointer */
-		uint32_t sp32;
-	};
-	
-	union
-	{
-		struct
-		{
-			uint8_t c;
-			uint8_t b;
-		};
-		uint16_t bc;
-		uint32_t bc32;
-	};
 
 	union
 	{
@@ -238,77 +327,121 @@ struct cpu_registers_s
 		uint16_t hl;
 		uint32_t hl32;
 	};
+	
+	union
+	{
+		uint16_t sp; /* Stack pointer */
+		uint32_t sp32;
+	};
+};
+
+/* A decoded instruction. */
+struct cpu_op_s
+{
+	uint8_t opcode;
+	uint8_t len;
+	uint16_t imm;
+};
+
+/* A run of instructions ending at a jump, or at a memory region boundary. */
+struct cpu_block_s
+{
+	uint16_t pc;
+	uint16_t bank;
+	uint8_t count;
+	/* Kind of copy or fill loop the block is, if any. */
+	uint8_t loop;
+	/* Value of block_cache.clock when last looked up, for LRU eviction. */
+	uint32_t used;
+	struct cpu_op_s op[BLOCK_MAX_OPS];
 };
 
 struct count_s
 {
-	uint_fast16_t lcd_count;	/* LCD Timing */
-	uint_fast16_t div_count;	/* Divider Register Counter */
-	uint_fast16_t tima_count;	/* Timer Counter */
+	/* Event scheduling.
+	 * The counters below are only brought up to date when an event is
+	 * due, rather than after every instruction. */
+	uint_fast32_t cycles;		/* Cycles run since events were processed. */
+	uint_fast32_t event_cycles;	/* Value of cycles at which the next event is due. */
+
+	uint_fast32_t lcd_count;	/* LCD Timing */
+	uint_fast32_t tima_count;	/* Cycles since TIMA was incremented. */
 	uint_fast16_t serial_count;	/* Serial Counter */
+#if PEANUT_GB_DMA_TIMING
+	uint_fast16_t dma_count;	/* Cycles left of OAM DMA, or 0. */
+#endif
+	/* Low 16 bits of the time at which the divider was last 0. DIV is
+	 * worked out from it when read, rather than counted. */
+	uint16_t div_base;
+
+	/* Cycles run since gb_reset(), up to when events were last
+	 * processed. The current time is time + cycles. */
+	uint64_t time;
+	/* Value of time at which the last gb_run_cycles() call was to return,
+	 * or 0 if gb_run_frame() has been called since. */
+	uint64_t stop_time;
 };
 
 struct gb_registers_s
 {
-	/* TODO: Sort variables in address order. */
+	/* Registers are laid out at their addresses from IO_ADDR, so that the
+	 * IO area, HRAM and IE can also be accessed as a flat array. */
+	/* Joypad info. */
+	uint8_t P1;			/* 0xFF00 */
+
+	/* Serial data. */
+	uint8_t SB;			/* 0xFF01 */
+	uint8_t SC;			/* 0xFF02 */
+	uint8_t unused_03;
+
 	/* Timing */
-	uint8_t TIMA, TMA, DIV;
+	uint8_t DIV;			/* 0xFF04 */
+	uint8_t TIMA;			/* 0xFF05 */
+	uint8_t TMA;			/* 0xFF06 */
 	union
 	{
 		struct
 		{
-			unsigned tac_rate : 2;	/* Input clock select */
-			unsigned tac_enable : 1;	/* Timer enable */
-			unsigned unused : 5;
+			uint8_t tac_rate : 2;	/* Input clock select */
+			uint8_t tac_enable : 1;	/* Timer enable */
+			uint8_t unused : 5;
 		};
-		uint8_t TAC;
+		uint8_t TAC;		/* 0xFF07 */
 	};
+	uint8_t unused_08[0x0F - 0x08];
 
-	/* LCD */
-	uint8_t LCDC;
-	uint8_t STAT;
-	uint8_t SCY;
-	uint8_t SCX;
-	uint8_t LY;
-	uint8_t LYC;
-	uint8_t DMA;
-	uint8_t BGP;
-	uint8_t OBP0;
-	uint8_t OBP1;
-	uint8_t WY;
-	uint8_t WX;
-
-	/* Joypad info. */
-	uint8_t P1;
+	/* Interrupt flag. */
+	uint8_t IF;			/* 0xFF0F */
 
-	/* Serial data. */
-	uint8_t SB;
-	uint8_t SC;
+	/* APU registers, only stored here when sound is disabled. */
+	uint8_t sound[0x40 - 0x10];	/* 0xFF10 */
 
-	/* Interrupt flag. */
-	uint8_t IF;
+	/* LCD */
+	uint8_t LCDC;			/* 0xFF40 */
+	uint8_t STAT;			/* 0xFF41 */
+	uint8_t SCY;			/* 0xFF42 */
+	uint8_t SCX;			/* 0xFF43 */
+	uint8_t LY;			/* 0xFF44 */
+	uint8_t LYC;			/* 0xFF45 */
+	uint8_t DMA;			/* 0xFF46 */
+	uint8_t BGP;			/* 0xFF47 */
+	uint8_t OBP0;			/* 0xFF48 */
+	uint8_t OBP1;			/* 0xFF49 */
+	uint8_t WY;			/* 0xFF4A */
+	uint8_t WX;			/* 0xFF4B */
+
+	/* Unused registers, then HRAM. */
+	uint8_t unused_4c[0xFF - 0x4C];
 
 	/* Interrupt enable. */
-	uint8_t IE;
+	uint8_t IE;			/* 0xFFFF */
 };
+_Static_assert(sizeof(struct gb_registers_s) == HRAM_SIZE,
+		"IO registers must be laid out at their addresses");
 
 #if ENABLE_LCD
 	/* Bit mask for the shade of pixel to display */
 	#define LCD_COLOUR	0x03
-	/**
-	* Bit mask for whether a pixel is OBJ0, OBJ1, or BG. Each may have a different
-	* palette when playing a DMG game on CGB.
-	*/
-	#define LCD_PALETTE_OBJ	0x10
-	#define LCD_PALETTE_BG	0x20
-	/**
-	* Bit mask for the two bits listed above.
-	* LCD_PALETTE_ALL == 0b00 --> OBJ0
-	* LCD_PALETTE_ALL == 0b01 --> OBJ1
-	* LCD_PALETTE_ALL == 0b10 --> BG
-	* LCD_PALETTE_ALL == 0b11 --> NOT POSSIBLE
-	*/
-	#define LCD_PALETTE_ALL 0x30
 #endif
 
 /**
@@ -331,7 +464,8 @@ enum gb_init_error_e
 {
 	GB_INIT_NO_ERROR,
 	GB_INIT_CARTRIDGE_UNSUPPORTED,
-	GB_INIT_INVALID_CHECKSUM
+	GB_INIT_INVALID_CHECKSUM,
+	GB_INIT_OUT_OF_MEMORY
 };
 
 /**
@@ -343,6 +477,31 @@ enum gb_serial_rx_ret_e
 	GB_SERIAL_RX_NO_CONNECTION = 1
 };
 
+/**
+ * What a line is drawn from, other than the line number and the previous
+ * contents of the frame buffer.
+ */
+struct gb_line_inputs_s
+{
+	/* Sum of the versions of the map rows used and of OAM. */
+	uint32_t versions;
+	/* Sum of the versions of the tiles used. */
+	uint32_t tiles;
+
+	uint8_t LCDC;
+	uint8_t SCY;
+	uint8_t SCX;
+	uint8_t WY;
+	uint8_t WX;
+	uint8_t window_line;
+	uint8_t BGP;
+	uint8_t OBP0;
+	uint8_t OBP1;
+	/* Zero, so that the structure has no padding and can be compared with
+	 * memcmp(). */
+	uint8_t unused[3];
+};
+
 /**
  * Emulator context.
  *
@@ -351,6 +510,55 @@ enum gb_serial_rx_ret_e
  */
 struct gb_s
 {
+	/* State used by almost every instruction comes first, so that it
+	 * shares as few cache lines as possible. The frame buffer, decoded tiles
+	 * and block cache are allocated separately by gb_init(). */
+	struct cpu_registers_s cpu_reg;
+	struct
+	{
+		unsigned gb_halt	: 1;
+		unsigned gb_ime		: 1;
+		unsigned gb_bios_enable : 1;
+		unsigned gb_frame	: 1; /* New frame drawn. */
+
+#		define LCD_HBLANK	0
+#		define LCD_VBLANK	1
+#		define LCD_SEARCH_OAM	2
+#		define LCD_TRANSFER	3
+		unsigned lcd_mode	: 2;
+		unsigned lcd_blank	: 1;
+	};
+	struct count_s counter;
+
+	/* Host memory backing each 4 KiB page of the address space, or NULL
+	 * where accesses must go through __gb_read() and __gb_write(). */
+	const uint8_t *read_page[0x10];
+	uint8_t *write_page[0x10];
+
+#if PEANUT_GB_BLOCK_CACHE
+	struct
+	{
+		/* Empty blocks have a count of 0. */
+		struct cpu_block_s (*block)[BLOCK_CACHE_WAYS];
+		uint32_t clock;
+	} block_cache;
+#endif
+
+	/**
+	 * Cartridge ROM and RAM access (0x0000-0x7FFF and 0xA000-0xBFFF),
+	 * specialised for the cartridge's MBC. Set by gb_init().
+	 */
+	uint8_t (*cart_read)(struct gb_s*, const uint_fast16_t addr);
+	void (*cart_write)(struct gb_s*, const uint_fast16_t addr,
+			   const uint8_t val);
+
+	union
+	{
+		struct gb_registers_s gb_reg;
+		/* IO registers, HRAM and IE, indexed by addr - IO_ADDR. */
+		uint8_t hram[HRAM_SIZE];
+	};
+
 	/**
 	 * Return byte from ROM at given address.
 	 *
@@ -392,21 +600,6 @@ struct gb_s
 	void (*gb_serial_tx)(struct gb_s*, const uint8_t tx);
 	enum gb_serial_rx_ret_e (*gb_serial_rx)(struct gb_s*, uint8_t* rx);
 
-	struct
-	{
-		unsigned gb_halt	: 1;
-		unsigned gb_ime		: 1;
-		unsigned gb_bios_enable : 1;
-		unsigned gb_frame	: 1; /* New frame drawn. */
-
-#		define LCD_HBLANK	0
-#		define LCD_VBLANK	1
-#		define LCD_SEARCH_OAM	2
-#		define LCD_TRANSFER	3
-		unsigned lcd_mode	: 2;
-		unsigned lcd_blank	: 1;
-	};
-
 	/* Cartridge information:
 	 * Memory Bank Controller (MBC) type. */
 	uint8_t mbc;
@@ -423,6 +616,17 @@ struct gb_s
 	uint8_t enable_cart_ram;
 	/* Cartridge ROM/RAM mode select. */
 	uint8_t cart_mode_select;
+	/* ROM held in memory by the front-end, or NULL to read it through
+	 * gb_rom_read(). rom_bank points to the bank currently mapped at
+	 * ROM_N_ADDR, and is kept up to date by the MBC write handlers. */
+	const uint8_t *rom;
+	const uint8_t *rom_bank;
+	/* Cart RAM held in memory by the front-end, or NULL to access it
+	 * through gb_cart_ram_read() and gb_cart_ram_write(). */
+	uint8_t *cart_ram_data;
+	/* Set when cart RAM is written. While it is set, writes to the
+	 * selected bank of cart_ram_data go through the page table. */
+	uint8_t cart_ram_dirty;
 	union
 	{
 		struct
@@ -436,36 +640,45 @@ struct gb_s
 		uint8_t cart_rtc[5];
 	};
 
-	struct cpu_registers_s cpu_reg;
-	struct gb_registers_s gb_reg;
-	struct count_s counter;
+#if PEANUT_GB_IDLE_LOOP_SKIP
+	struct
+	{
+		/* Results of analysing backward jumps in ROM. */
+		struct
+		{
+			uint16_t jr_addr;
+			uint16_t bank;
+			/* Cycles per iteration, or 0 if this is not an idle
+			 * loop. */
+			uint8_t cycles;
+		} cache[IDLE_LOOP_CACHE_SIZE];
+
+		/* Last idle loop jump taken, and the value of counter.cycles
+		 * at that point. */
+		uint16_t jr_addr;
+		uint_fast32_t cycles;
+	} idle;
+#endif
 
-	/* TODO: Allow implementation to allocate WRAM, VRAM and Frame Buffer. */
+	/* Allocation holding the frame buffer, the decoded tiles and the block
+	 * cache, each aligned to PEANUT_GB_CACHE_LINE. Released by gb_free(). */
+	void *mem;
 	uint8_t wram[WRAM_SIZE];
 	uint8_t vram[VRAM_SIZE];
-	uint8_t hram[HRAM_SIZE];
 	uint8_t oam[OAM_SIZE];
+	/* Used when direct.sound_enabled is set. */
+	struct minigb_apu_ctx apu;
 
 	struct
 	{
 		/**
-		 * Draw line on screen.
+		 * Front-end callback given to gb_init_lcd(). Lines are drawn
+		 * to fb rather than passed to it, and fb holds only the shade
+		 * of each pixel, not which palette it came from.
 		 *
 		 * \param gb_s		emulator context
-		 * \param pixels	The 160 pixels to draw.
-		 * 			Bits 1-0 are the colour to draw.
-		 * 			Bits 5-4 are the palette, where:
-		 * 				OBJ0 = 0b00,
-		 * 				OBJ1 = 0b01,
-		 * 				BG = 0b10
-		 * 			Other bits are undefined.
-		 * 			Bits 5-4 are only required by front-ends
-		 * 			which want to use a different colour for
-		 * 			different object palettes. This is what
-		 * 			the Game Boy Color (CGB) does to DMG
-		 * 			games.
-		 * \param line		Line to draw pixels on. This is
-		 * guaranteed to be between 0-144 inclusive.
+		 * \param line		Line that changed. This is
+		 * guaranteed to be between 0-143 inclusive.
 		 */
 		void (*lcd_line_changed)(struct gb_s *gb,
 				const uint_fast8_t line);
@@ -480,13 +693,50 @@ struct gb_s
 		/* Only support 30fps frame skip. */
 		unsigned frame_skip_count : 1;
 		unsigned interlace_count : 1;
+		/* Set when OAM or the sprite size changes, so that the line
+		 * sprite lists must be rebuilt before they are used. */
+		unsigned sprites_dirty : 1;
 		
 		/* Playdate custom implementation */
-		unsigned back_fb_enabled : 1;
-		
-		uint8_t front_fb[LCD_HEIGHT][LCD_WIDTH];
-		uint8_t back_fb[LCD_HEIGHT][LCD_WIDTH];
-		uint32_t changed_rows[LCD_HEIGHT];
+		/* Shade (0-3) of each pixel, packed four to a byte with the
+		 * leftmost in the top bits. Read with gb_fb_pixel(). */
+		uint8_t (*fb)[LCD_WIDTH / 4];
+		/* Bit y of word y / 32 is set if line y changed in the last
+		 * frame. Read with gb_line_changed(). */
+		uint32_t changed_rows[(LCD_HEIGHT + 31) / 32];
+
+		/* Tile data decoded to one colour (0-3) per pixel, indexed by
+		 * tile, row and column. Updated as VRAM is written. */
+		uint8_t (*tiles)[8][8];
+
+		/* Sprite numbers on each line, highest priority first. */
+		uint8_t line_sprites[LCD_HEIGHT][LINE_SPRITES];
+		uint8_t line_sprite_count[LCD_HEIGHT];
+
+		/* Versions of each tile, map row and OAM, counted up whenever
+		 * they are written. */
+		uint32_t tile_version[NUM_TILES];
+		uint32_t map_version[NUM_MAP_ROWS];
+		uint32_t oam_version;
+
+		/* What each line was last drawn from, and whether it is still
+		 * in fb. Lines with the same inputs are not drawn again. */
+		struct gb_line_inputs_s line_inputs[LCD_HEIGHT];
+		uint8_t line_drawn[LCD_HEIGHT];
+
+		/* Playdate custom implementation: 1-bit output set up by
+		 * gb_set_dither(). Off while frame is NULL. */
+		struct
+		{
+			uint8_t *frame;
+			uint16_t stride;
+			uint8_t x;
+			uint8_t scale;
+			uint8_t rows[LCD_HEIGHT][2];
+			/* Pattern of each shade by row modulo 4, repeated in
+			 * both halves of the byte. */
+			uint8_t patterns[4][4];
+		} dither;
 		uint32_t changed_row_count;
 	} display;
 
@@ -505,6 +755,9 @@ struct gb_s
 		unsigned interlace : 1;
 		unsigned frame_skip : 1;
 		unsigned sound_enabled : 1;
+		/* Set by gb_init(). Clear for ROMs that misbehave when idle
+		 * loops are skipped. */
+		unsigned idle_skip : 1;
 
 		union
 		{
@@ -531,14 +784,51 @@ uint8_t __gb_read(struct gb_s *gb, const uint_fast16_t addr);
 
 void __gb_write(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val);
 
+uint8_t __gb_read_io(struct gb_s *gb, const uint_fast16_t addr);
+
+void __gb_write_io(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val);
+
+/* Returns the ROM bank mapped at ROM_N_ADDR. With MBC1 in mode 1, only the low
+ * five bits of selected_rom_bank are used. */
+static inline uint_fast16_t __gb_rom_bank(const struct gb_s *gb)
+{
+	if(gb->mbc == 1 && gb->cart_mode_select)
+		return gb->selected_rom_bank & 0x1F;
+
+	return gb->selected_rom_bank;
+}
+
+#if ENABLE_LCD
+/**
+ * Bring what is worked out from VRAM up to date after len bytes are written
+ * from addr, relative to VRAM_ADDR.
+ */
+void __gb_vram_written(struct gb_s *gb, const uint_fast16_t addr,
+		const uint_fast16_t len);
+#endif
+
 void gb_tick_rtc(struct gb_s *gb);
 
 void gb_set_rtc(struct gb_s *gb, const struct tm * const time);
 
-uint8_t __gb_step_chunked(struct cpu_registers_s *regs);
+void __gb_run_cpu(struct gb_s *gb);
+#if PEANUT_GB_IDLE_LOOP_SKIP
+void __gb_idle_loop(struct gb_s *gb, const uint_fast16_t target,
+		const uint_fast16_t jr_addr);
+#endif
 
-extern struct gb_s *peanut_exec_gb;
+/**
+ * Run until the end of the frame: the start of VBLANK, or LCD_FRAME_CYCLES
+ * after the last frame ended while the LCD is off.
+ */
 void gb_run_frame(struct gb_s *gb);
+
+/**
+ * Run for the given number of cycles, regardless of frames. A few more cycles
+ * may be run, to finish an instruction. Consecutive calls count from where the
+ * last one should have stopped, so the error does not build up.
+ */
+void gb_run_cycles(struct gb_s *gb, const uint_fast32_t cycles);
 uint_fast32_t gb_get_save_size(struct gb_s *gb);
 
 /**
@@ -559,6 +849,34 @@ static void gb_init_serial(
 
 void gb_reset(struct gb_s *gb);
 
+/**
+ * Give the emulator direct access to the whole ROM, held in memory. This is
+ * optional, and avoids calling gb_rom_read() for every ROM access. Must be
+ * called after gb_init(). The ROM must be at least as large as the cartridge
+ * header says, and must stay valid until the context is no longer used.
+ */
+void gb_set_rom(struct gb_s *gb, const uint8_t *rom);
+
+/**
+ * Give the emulator direct access to cart RAM, held in memory. This is
+ * optional, and avoids calling gb_cart_ram_read() and gb_cart_ram_write() for
+ * every cart RAM access. Must be called after gb_init(). The memory must be at
+ * least gb_get_save_size() bytes.
+ */
+void gb_set_cart_ram(struct gb_s *gb, uint8_t *ram);
+
+/**
+ * Returns whether cart RAM was written since gb_init() or the last call to
+ * gb_cart_ram_clear_modified(), so that the front-end only needs to save it
+ * when it has changed.
+ */
+uint8_t gb_cart_ram_modified(const struct gb_s *gb);
+
+/**
+ * Mark cart RAM as unmodified. Call this once its contents have been saved.
+ */
+void gb_cart_ram_clear_modified(struct gb_s *gb);
+
 enum gb_init_error_e gb_init(
 	struct gb_s *gb,
 	uint8_t (*gb_rom_read)(struct gb_s*, const uint_fast32_t),
@@ -568,14 +886,52 @@ enum gb_init_error_e gb_init(
 	void *priv
 );
 
+/**
+ * Release the memory allocated by gb_init(). The context must be initialised
+ * again before it is used.
+ */
+void gb_free(struct gb_s *gb);
+
 const char* gb_get_rom_name(struct gb_s* gb, char *title_str);
 
+/* Returns the shade (0-3) of pixel x in row, a line of display.fb. */
+static inline uint8_t gb_fb_pixel(const uint8_t *row, const uint_fast8_t x)
+{
+	return (row[x >> 2] >> (6 - 2 * (x & 3))) & 3;
+}
+
+/* Returns whether line y changed in the last frame. */
+static inline int gb_line_changed(const struct gb_s *gb, const uint_fast8_t y)
+{
+	return (gb->display.changed_rows[y >> 5] >> (y & 31)) & 1;
+}
+
 #if ENABLE_LCD
 void gb_init_lcd(
     struct gb_s *gb,
     void (*lcd_line_changed)(struct gb_s *gb,
     const uint_fast8_t line)
 );
+
+/**
+ * Have the PPU dither each line that changes straight into a 1-bit frame, as
+ * it is drawn to the frame buffer.
+ *
+ * \param frame	1-bit image with the leftmost pixel of each byte in
+ * 			bit 7, or NULL to stop dithering.
+ * \param stride	Bytes per row of frame.
+ * \param x		Byte in each row that lines start at.
+ * \param scale	Bits per pixel across, 1 or 2.
+ * \param rows	Up to two rows of frame that each line is drawn to, or
+ * 			GB_DITHER_NO_ROW.
+ * \param patterns	For each shade and row modulo 4, the pattern of four
+ * 			columns with the leftmost in bit 3. Columns are counted
+ * 			from x.
+ */
+void gb_set_dither(struct gb_s *gb, uint8_t *frame,
+		const uint_fast16_t stride, const uint_fast8_t x,
+		const uint_fast8_t scale, const uint8_t rows[LCD_HEIGHT][2],
+		const uint8_t patterns[4][4]);
 #endif
 
 #endif //PEANUT_GB_H
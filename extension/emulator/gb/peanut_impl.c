@@ -1,211 +1,94 @@
 #include "peanut_gb.h"
 
+static void __gb_run_events(struct gb_s *gb);
+static void __gb_map_rom(struct gb_s *gb);
+static void __gb_map_cart_ram(struct gb_s *gb);
+
 /**
- * Internal function used to read bytes.
+ * Cartridge reads and writes, for ROM and cartridge RAM. The MBC never changes
+ * after gb_init(), so these are specialised for each MBC type below, with mbc
+ * as a constant.
  */
-uint8_t __gb_read(struct gb_s *gb, const uint_fast16_t addr)
+static inline __attribute__((always_inline))
+uint8_t __gb_cart_read(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t mbc)
 {
 	switch(addr >> 12)
 	{
 	case 0x0:
-
-	/* TODO: BIOS support. */
 	case 0x1:
 	case 0x2:
 	case 0x3:
+		if(gb->rom)
+			return gb->rom[addr];
+
 		return gb->gb_rom_read(gb, addr);
 
 	case 0x4:
 	case 0x5:
 	case 0x6:
 	case 0x7:
-		if(gb->mbc == 1 && gb->cart_mode_select)
+		if(gb->rom)
+			return gb->rom_bank[addr - ROM_N_ADDR];
+		else if(mbc == 1 && gb->cart_mode_select)
 			return gb->gb_rom_read(gb,
 					       addr + ((gb->selected_rom_bank & 0x1F) - 1) * ROM_BANK_SIZE);
 		else
 			return gb->gb_rom_read(gb, addr + (gb->selected_rom_bank - 1) * ROM_BANK_SIZE);
 
-	case 0x8:
-	case 0x9:
-		return gb->vram[addr - VRAM_ADDR];
-
-	case 0xA:
-	case 0xB:
+	default:
 		if(gb->cart_ram && gb->enable_cart_ram)
 		{
-			if(gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
+			uint_fast32_t ram_addr = addr - CART_RAM_ADDR;
+
+			if(mbc == 3 && gb->cart_ram_bank >= 0x08)
 				return gb->cart_rtc[gb->cart_ram_bank - 0x08];
-			else if((gb->cart_mode_select || gb->mbc != 1) &&
+			else if((gb->cart_mode_select || mbc != 1) &&
 					gb->cart_ram_bank < gb->num_ram_banks)
-			{
-				return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR +
-							    (gb->cart_ram_bank * CRAM_BANK_SIZE));
-			}
-			else
-				return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR);
-		}
-
-		return 0xFF;
-
-	case 0xC:
-		return gb->wram[addr - WRAM_0_ADDR];
-
-	case 0xD:
-		return gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE];
-
-	case 0xE:
-		return gb->wram[addr - ECHO_ADDR];
-
-	case 0xF:
-		if(addr < OAM_ADDR)
-			return gb->wram[addr - ECHO_ADDR];
-
-		if(addr < UNUSED_ADDR)
-			return gb->oam[addr - OAM_ADDR];
+				ram_addr += gb->cart_ram_bank * CRAM_BANK_SIZE;
 
-		/* Unusable memory area. Reading from this area returns 0.*/
-		if(addr < IO_ADDR)
-			return 0xFF;
-
-		/* HRAM */
-		if(HRAM_ADDR <= addr && addr < INTR_EN_ADDR)
-			return gb->hram[addr - IO_ADDR];
+			if(gb->cart_ram_data)
+				return gb->cart_ram_data[ram_addr];
 
-		/* APU registers. */
-		if((addr >= 0xFF10) && (addr <= 0xFF3F))
-		{
-			if(gb->direct.sound_enabled) {
-				return audio_read(addr);
-			}
-			else {
-				static const uint8_t ortab[] = {
-					0x80, 0x3f, 0x00, 0xff, 0xbf,
-					0xff, 0x3f, 0x00, 0xff, 0xbf,
-					0x7f, 0xff, 0x9f, 0xff, 0xbf,
-					0xff, 0xff, 0x00, 0x00, 0xbf,
-					0x00, 0x00, 0x70,
-					0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-					0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-					0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-				};
-				return gb->hram[addr - IO_ADDR] | ortab[addr - IO_ADDR];
-			}
+			return gb->gb_cart_ram_read(gb, ram_addr);
 		}
 
-		/* IO and Interrupts. */
-		switch(addr & 0xFF)
-		{
-		/* IO Registers */
-		case 0x00:
-			return 0xC0 | gb->gb_reg.P1;
-
-		case 0x01:
-			return gb->gb_reg.SB;
-
-		case 0x02:
-			return gb->gb_reg.SC;
-
-		/* Timer Registers */
-		case 0x04:
-			return gb->gb_reg.DIV;
-
-		case 0x05:
-			return gb->gb_reg.TIMA;
-
-		case 0x06:
-			return gb->gb_reg.TMA;
-
-		case 0x07:
-			return gb->gb_reg.TAC;
-
-		/* Interrupt Flag Register */
-		case 0x0F:
-			return gb->gb_reg.IF;
-
-		/* LCD Registers */
-		case 0x40:
-			return gb->gb_reg.LCDC;
-
-		case 0x41:
-			return (gb->gb_reg.STAT & STAT_USER_BITS) |
-			       (gb->gb_reg.LCDC & LCDC_ENABLE ? gb->lcd_mode : LCD_VBLANK);
-
-		case 0x42:
-			return gb->gb_reg.SCY;
-
-		case 0x43:
-			return gb->gb_reg.SCX;
-
-		case 0x44:
-			return gb->gb_reg.LY;
-
-		case 0x45:
-			return gb->gb_reg.LYC;
-
-		/* DMA Register */
-		case 0x46:
-			return gb->gb_reg.DMA;
-
-		/* DMG Palette Registers */
-		case 0x47:
-			return gb->gb_reg.BGP;
-
-		case 0x48:
-			return gb->gb_reg.OBP0;
-
-		case 0x49:
-			return gb->gb_reg.OBP1;
-
-		/* Window Position Registers */
-		case 0x4A:
-			return gb->gb_reg.WY;
-
-		case 0x4B:
-			return gb->gb_reg.WX;
-
-		/* Interrupt Enable Register */
-		case 0xFF:
-			return gb->gb_reg.IE;
-
-		/* Unused registers return 1 */
-		default:
-			return 0xFF;
-		}
+		return 0xFF;
 	}
-
-	(gb->gb_error)(gb, GB_INVALID_READ, addr);
-	return 0xFF;
 }
 
-/**
- * Internal function used to write bytes.
- */
-void __gb_write(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val)
+static inline __attribute__((always_inline))
+void __gb_cart_write(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val, const uint8_t mbc)
 {
 	switch(addr >> 12)
 	{
 	case 0x0:
 	case 0x1:
-		if(gb->mbc == 2 && addr & 0x10)
+		if(mbc == 2 && addr & 0x10)
 			return;
-		else if(gb->mbc > 0 && gb->cart_ram)
+		else if(mbc > 0 && gb->cart_ram)
+		{
 			gb->enable_cart_ram = ((val & 0x0F) == 0x0A);
+			__gb_map_cart_ram(gb);
+		}
 
 		return;
 
 	case 0x2:
-		if(gb->mbc == 5)
+		if(mbc == 5)
 		{
 			gb->selected_rom_bank = (gb->selected_rom_bank & 0x100) | val;
 			gb->selected_rom_bank =
 				gb->selected_rom_bank & gb->num_rom_banks_mask;
+			__gb_map_rom(gb);
 			return;
 		}
 
 	/* Intentional fall through. */
 
 	case 0x3:
-		if(gb->mbc == 1)
+		if(mbc == 1)
 		{
 			//selected_rom_bank = val & 0x7;
 			gb->selected_rom_bank = (val & 0x1F) | (gb->selected_rom_bank & 0x60);
@@ -213,264 +96,678 @@ void __gb_write(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val)
 			if((gb->selected_rom_bank & 0x1F) == 0x00)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 2 && addr & 0x10)
+		else if(mbc == 2 && addr & 0x10)
 		{
 			gb->selected_rom_bank = val & 0x0F;
 
 			if(!gb->selected_rom_bank)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 3)
+		else if(mbc == 3)
 		{
 			gb->selected_rom_bank = val & 0x7F;
 
 			if(!gb->selected_rom_bank)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 5)
+		else if(mbc == 5)
 			gb->selected_rom_bank = (val & 0x01) << 8 | (gb->selected_rom_bank & 0xFF);
 
 		gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
+		__gb_map_rom(gb);
 		return;
 
 	case 0x4:
 	case 0x5:
-		if(gb->mbc == 1)
+		if(mbc == 1)
 		{
 			gb->cart_ram_bank = (val & 3);
 			gb->selected_rom_bank = ((val & 3) << 5) | (gb->selected_rom_bank & 0x1F);
 			gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
+			__gb_map_rom(gb);
 		}
-		else if(gb->mbc == 3)
+		else if(mbc == 3)
 			gb->cart_ram_bank = val;
-		else if(gb->mbc == 5)
+		else if(mbc == 5)
 			gb->cart_ram_bank = (val & 0x0F);
 
+		__gb_map_cart_ram(gb);
 		return;
 
 	case 0x6:
 	case 0x7:
 		gb->cart_mode_select = (val & 1);
-		return;
 
-	case 0x8:
-	case 0x9:
-		gb->vram[addr - VRAM_ADDR] = val;
+		if(mbc == 1)
+			__gb_map_rom(gb);
+
+		__gb_map_cart_ram(gb);
 		return;
 
-	case 0xA:
-	case 0xB:
+	default:
 		if(gb->cart_ram && gb->enable_cart_ram)
 		{
-			if(gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
+			uint_fast32_t ram_addr = addr - CART_RAM_ADDR;
+
+			if(mbc == 3 && gb->cart_ram_bank >= 0x08)
+			{
 				gb->cart_rtc[gb->cart_ram_bank - 0x08] = val;
+				return;
+			}
 			else if(gb->cart_mode_select &&
 					gb->cart_ram_bank < gb->num_ram_banks)
+				ram_addr += gb->cart_ram_bank * CRAM_BANK_SIZE;
+			else if(!gb->num_ram_banks)
+				return;
+
+			if(gb->cart_ram_data)
+				gb->cart_ram_data[ram_addr] = val;
+			else
+				gb->gb_cart_ram_write(gb, ram_addr, val);
+
+			/* Map the bank for writing until the front-end has
+			 * seen that cart RAM changed. */
+			if(!gb->cart_ram_dirty)
 			{
-				gb->gb_cart_ram_write(gb,
-						      addr - CART_RAM_ADDR + (gb->cart_ram_bank * CRAM_BANK_SIZE), val);
+				gb->cart_ram_dirty = 1;
+				__gb_map_cart_ram(gb);
 			}
-			else if(gb->num_ram_banks)
-				gb->gb_cart_ram_write(gb, addr - CART_RAM_ADDR, val);
 		}
 
 		return;
+	}
+}
 
-	case 0xC:
-		gb->wram[addr - WRAM_0_ADDR] = val;
-		return;
+#define CART_HANDLERS(mbc)						\
+static uint8_t __gb_cart_read_mbc##mbc(struct gb_s *gb,			\
+		const uint_fast16_t addr)				\
+{									\
+	return __gb_cart_read(gb, addr, mbc);				\
+}									\
+static void __gb_cart_write_mbc##mbc(struct gb_s *gb,			\
+		const uint_fast16_t addr, const uint8_t val)		\
+{									\
+	__gb_cart_write(gb, addr, val, mbc);				\
+}
 
-	case 0xD:
-		gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE] = val;
+CART_HANDLERS(0)
+CART_HANDLERS(1)
+CART_HANDLERS(2)
+CART_HANDLERS(3)
+CART_HANDLERS(5)
+#undef CART_HANDLERS
+
+/**
+ * Point rom_bank at the selected ROM bank, and map ROM into the page table if
+ * it is held in memory. Called whenever the selected bank may have changed.
+ */
+static void __gb_map_rom(struct gb_s *gb)
+{
+	if(gb->rom == NULL || DMA_ACTIVE(gb))
 		return;
 
-	case 0xE:
-		gb->wram[addr - ECHO_ADDR] = val;
+	gb->rom_bank = gb->rom + __gb_rom_bank(gb) * ROM_BANK_SIZE;
+
+	for(uint_fast8_t i = 0; i < ROM_N_ADDR >> 12; i++)
+	{
+		gb->read_page[i] = gb->rom + (i << 12);
+		gb->read_page[i + (ROM_N_ADDR >> 12)] = gb->rom_bank + (i << 12);
+	}
+}
+
+/**
+ * Map the selected cart RAM bank into the page table if cart RAM is held in
+ * memory and enabled. Writes are only mapped while cart_ram_dirty is set, so
+ * that the first write after the front-end checks it is seen. Banks are
+ * selected as in __gb_cart_read() and __gb_cart_write().
+ */
+static void __gb_map_cart_ram(struct gb_s *gb)
+{
+	const uint8_t *read = NULL;
+	uint8_t *write = NULL;
+
+	if(gb->cart_ram_data && gb->cart_ram && gb->enable_cart_ram &&
+			!(gb->mbc == 3 && gb->cart_ram_bank >= 0x08) &&
+			!DMA_ACTIVE(gb))
+	{
+		const uint_fast32_t bank_addr =
+			gb->cart_ram_bank * CRAM_BANK_SIZE;
+
+		read = gb->cart_ram_data;
+
+		if((gb->cart_mode_select || gb->mbc != 1) &&
+				gb->cart_ram_bank < gb->num_ram_banks)
+			read += bank_addr;
+
+		if(gb->cart_ram_dirty && gb->cart_mode_select &&
+				gb->cart_ram_bank < gb->num_ram_banks)
+			write = gb->cart_ram_data + bank_addr;
+		else if(gb->cart_ram_dirty && gb->num_ram_banks)
+			write = gb->cart_ram_data;
+	}
+
+	for(uint_fast8_t i = 0; i < CRAM_BANK_SIZE >> 12; i++)
+	{
+		gb->read_page[(CART_RAM_ADDR >> 12) + i] =
+			read ? read + (i << 12) : NULL;
+		gb->write_page[(CART_RAM_ADDR >> 12) + i] =
+			write ? write + (i << 12) : NULL;
+	}
+}
+
+/**
+ * Fill in the page table with the memory that can be accessed directly.
+ */
+static void __gb_map_pages(struct gb_s *gb)
+{
+	for(uint_fast8_t i = 0; i < 0x10; i++)
+	{
+		gb->read_page[i] = NULL;
+		gb->write_page[i] = NULL;
+	}
+
+	/* Only IO and HRAM can be accessed during OAM DMA. */
+	if(DMA_ACTIVE(gb))
 		return;
 
-	case 0xF:
-		if(addr < OAM_ADDR)
-		{
-			gb->wram[addr - ECHO_ADDR] = val;
-			return;
-		}
+	/* VRAM writes go through __gb_write() when the LCD is enabled, to keep
+	 * display.tiles up to date. */
+	for(uint_fast8_t i = VRAM_ADDR >> 12; i < CART_RAM_ADDR >> 12; i++)
+	{
+		gb->read_page[i] = &gb->vram[(i << 12) - VRAM_ADDR];
+#if !ENABLE_LCD
+		gb->write_page[i] = &gb->vram[(i << 12) - VRAM_ADDR];
+#endif
+	}
 
-		if(addr < UNUSED_ADDR)
+	/* WRAM and the start of its echo. The rest of the echo shares a page
+	 * with OAM and IO. */
+	for(uint_fast8_t i = WRAM_0_ADDR >> 12; i <= ECHO_ADDR >> 12; i++)
+	{
+		gb->write_page[i] = &gb->wram[((i << 12) - WRAM_0_ADDR) % WRAM_SIZE];
+		gb->read_page[i] = gb->write_page[i];
+	}
+
+	__gb_map_rom(gb);
+	__gb_map_cart_ram(gb);
+}
+
+/**
+ * IO register reads and writes with side effects. Registers without an entry
+ * in io_read or io_write are read and written as stored in gb->hram.
+ */
+static uint8_t __gb_read_p1(struct gb_s *gb, const uint_fast16_t addr)
+{
+	return 0xC0 | gb->gb_reg.P1;
+}
+
+static uint8_t __gb_read_stat(struct gb_s *gb, const uint_fast16_t addr)
+{
+	return (gb->gb_reg.STAT & STAT_USER_BITS) |
+	       (gb->gb_reg.LCDC & LCDC_ENABLE ? gb->lcd_mode : LCD_VBLANK);
+}
+
+static uint8_t __gb_read_apu(struct gb_s *gb, const uint_fast16_t addr)
+{
+	static const uint8_t ortab[] = {
+		0x80, 0x3f, 0x00, 0xff, 0xbf,
+		0xff, 0x3f, 0x00, 0xff, 0xbf,
+		0x7f, 0xff, 0x9f, 0xff, 0xbf,
+		0xff, 0xff, 0x00, 0x00, 0xbf,
+		0x00, 0x00, 0x70,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+
+	if(gb->direct.sound_enabled)
+		return audio_read(&gb->apu, addr);
+
+	return gb->hram[addr - IO_ADDR] | ortab[addr - IO_ADDR];
+}
+
+/* Number of cycles per TIMA increment for each TAC input clock. */
+static const uint_fast16_t TAC_CYCLES[4] = {1024, 16, 64, 256};
+
+static uint8_t __gb_read_div(struct gb_s *gb, const uint_fast16_t addr)
+{
+	const uint16_t div = gb->counter.time + gb->counter.cycles -
+		gb->counter.div_base;
+
+	return div >> 8;
+}
+
+/* TIMA is only brought up to date by events. Only its overflow is scheduled,
+ * so it cannot overflow between events. */
+static uint8_t __gb_read_tima(struct gb_s *gb, const uint_fast16_t addr)
+{
+	if(!gb->gb_reg.tac_enable)
+		return gb->gb_reg.TIMA;
+
+	return gb->gb_reg.TIMA + (gb->counter.tima_count + gb->counter.cycles) /
+		TAC_CYCLES[gb->gb_reg.tac_rate];
+}
+
+/* Unused registers return 1. */
+static uint8_t __gb_read_unused(struct gb_s *gb, const uint_fast16_t addr)
+{
+	return 0xFF;
+}
+
+static uint8_t (*const io_read[0x80])(struct gb_s*, const uint_fast16_t) =
+{
+	[0x00] = __gb_read_p1,
+	[0x03] = __gb_read_unused,
+	[0x04] = __gb_read_div,
+	[0x05] = __gb_read_tima,
+	[0x08 ... 0x0E] = __gb_read_unused,
+	[0x10 ... 0x3F] = __gb_read_apu,
+	[0x41] = __gb_read_stat,
+	[0x4C ... 0x7F] = __gb_read_unused
+};
+
+static void __gb_write_p1(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	/* Only bits 5 and 4 are R/W.
+	 * The lower bits are overwritten later, and the two most
+	 * significant bits are unused. */
+	gb->gb_reg.P1 = val;
+
+	/* Direction keys selected */
+	if((gb->gb_reg.P1 & 0b010000) == 0)
+		gb->gb_reg.P1 |= (gb->direct.joypad >> 4);
+	/* Button keys selected */
+	else
+		gb->gb_reg.P1 |= (gb->direct.joypad & 0x0F);
+}
+
+static void __gb_write_sc(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	__gb_run_events(gb);
+	gb->gb_reg.SC = val;
+	gb->counter.event_cycles = 0;
+}
+
+static void __gb_write_div(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	const uint16_t div = gb->counter.time + gb->counter.cycles -
+		gb->counter.div_base;
+
+	/* DIV is cleared, but the time to its next increment is kept. */
+	gb->counter.div_base += div & 0xFF00;
+}
+
+static void __gb_write_tima(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	__gb_run_events(gb);
+	gb->gb_reg.TIMA = val;
+	gb->counter.event_cycles = 0;
+}
+
+static void __gb_write_tac(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	__gb_run_events(gb);
+	gb->gb_reg.TAC = val;
+	gb->counter.event_cycles = 0;
+}
+
+static void __gb_write_if(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	gb->gb_reg.IF = (val | 0b11100000);
+	/* Stop the CPU to check for interrupts. */
+	gb->counter.event_cycles = 0;
+}
+
+static void __gb_write_apu(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	if(gb->direct.sound_enabled)
+		audio_write(&gb->apu, addr, val);
+	else
+		gb->hram[addr - IO_ADDR] = val;
+}
+
+static void __gb_write_lcdc(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	/* Bring the LCD up to date before changing its timing. */
+	__gb_run_events(gb);
+	gb->counter.event_cycles = 0;
+
+	if(((gb->gb_reg.LCDC & LCDC_ENABLE) == 0) &&
+		(val & LCDC_ENABLE))
+	{
+		gb->counter.lcd_count = 0;
+		gb->lcd_blank = 1;
+	}
+
+	/* The sprite size decides which lines each sprite is on. */
+	if((gb->gb_reg.LCDC ^ val) & LCDC_OBJ_SIZE)
+		gb->display.sprites_dirty = 1;
+
+	gb->gb_reg.LCDC = val;
+
+	/* LY fixed to 0 when LCD turned off. */
+	if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
+	{
+		/* Do not turn off LCD outside of VBLANK. This may
+		 * happen due to poor timing in this emulator. */
+		if(gb->lcd_mode != LCD_VBLANK)
 		{
-			gb->oam[addr - OAM_ADDR] = val;
+			gb->gb_reg.LCDC |= LCDC_ENABLE;
 			return;
 		}
 
-		/* Unusable memory area. */
-		if(addr < IO_ADDR)
-			return;
+		gb->gb_reg.STAT = (gb->gb_reg.STAT & ~0x03) | LCD_VBLANK;
+		gb->gb_reg.LY = 0;
+		gb->counter.lcd_count = 0;
+	}
+}
 
-		if(HRAM_ADDR <= addr && addr < INTR_EN_ADDR)
+static void __gb_write_stat(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	gb->gb_reg.STAT = (val & 0b01111000);
+}
+
+static void __gb_write_dma(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	uint_fast16_t src;
+	const uint8_t *page;
+	uint8_t changed = 0;
+
+#if PEANUT_GB_DMA_TIMING
+	/* A new transfer replaces one in progress. */
+	gb->counter.dma_count = 0;
+	__gb_map_pages(gb);
+#endif
+	gb->gb_reg.DMA = (val % 0xF1);
+	src = gb->gb_reg.DMA << 8;
+	page = gb->read_page[src >> 12];
+
+	/* The source never crosses a page, so it can be copied at once if the
+	 * page is mapped. Games usually copy the same sprites again every
+	 * frame, so OAM is only marked as changed if it is. */
+	if(page != NULL)
+	{
+		if(memcmp(gb->oam, page + (src & 0xFFF), OAM_SIZE) != 0)
 		{
-			gb->hram[addr - IO_ADDR] = val;
-			return;
+			memcpy(gb->oam, page + (src & 0xFFF), OAM_SIZE);
+			changed = 1;
 		}
-
-		if((addr >= 0xFF10) && (addr <= 0xFF3F))
+	}
+	else
+	{
+		for(uint8_t i = 0; i < OAM_SIZE; i++)
 		{
-			if(gb->direct.sound_enabled) {
-				audio_write(addr, val);
-			}
-			else {
-				gb->hram[addr - IO_ADDR] = val;
-			}
-			return;
+			const uint8_t b = __gb_read(gb, src + i);
+			changed |= gb->oam[i] ^ b;
+			gb->oam[i] = b;
 		}
+	}
 
-		/* IO and Interrupts. */
-		switch(addr & 0xFF)
-		{
-		/* Joypad */
-		case 0x00:
-			/* Only bits 5 and 4 are R/W.
-			 * The lower bits are overwritten later, and the two most
-			 * significant bits are unused. */
-			gb->gb_reg.P1 = val;
-
-			/* Direction keys selected */
-			if((gb->gb_reg.P1 & 0b010000) == 0)
-				gb->gb_reg.P1 |= (gb->direct.joypad >> 4);
-			/* Button keys selected */
-			else
-				gb->gb_reg.P1 |= (gb->direct.joypad & 0x0F);
+	if(changed)
+	{
+		gb->display.sprites_dirty = 1;
+		gb->display.oam_version++;
+	}
 
-			return;
+#if PEANUT_GB_DMA_TIMING
+	gb->counter.dma_count = DMA_CYCLES;
+	__gb_map_pages(gb);
+	gb->counter.event_cycles = 0;
+#endif
+}
 
-		/* Serial */
-		case 0x01:
-			gb->gb_reg.SB = val;
-			return;
+static void __gb_write_bgp(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	gb->gb_reg.BGP = val;
+	gb->display.bg_palette[0] = (gb->gb_reg.BGP & 0x03);
+	gb->display.bg_palette[1] = (gb->gb_reg.BGP >> 2) & 0x03;
+	gb->display.bg_palette[2] = (gb->gb_reg.BGP >> 4) & 0x03;
+	gb->display.bg_palette[3] = (gb->gb_reg.BGP >> 6) & 0x03;
+}
 
-		case 0x02:
-			gb->gb_reg.SC = val;
-			return;
+static void __gb_write_obp0(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	gb->gb_reg.OBP0 = val;
+	gb->display.sp_palette[0] = (gb->gb_reg.OBP0 & 0x03);
+	gb->display.sp_palette[1] = (gb->gb_reg.OBP0 >> 2) & 0x03;
+	gb->display.sp_palette[2] = (gb->gb_reg.OBP0 >> 4) & 0x03;
+	gb->display.sp_palette[3] = (gb->gb_reg.OBP0 >> 6) & 0x03;
+}
 
-		/* Timer Registers */
-		case 0x04:
-			gb->gb_reg.DIV = 0x00;
-			return;
+static void __gb_write_obp1(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	gb->gb_reg.OBP1 = val;
+	gb->display.sp_palette[4] = (gb->gb_reg.OBP1 & 0x03);
+	gb->display.sp_palette[5] = (gb->gb_reg.OBP1 >> 2) & 0x03;
+	gb->display.sp_palette[6] = (gb->gb_reg.OBP1 >> 4) & 0x03;
+	gb->display.sp_palette[7] = (gb->gb_reg.OBP1 >> 6) & 0x03;
+}
 
-		case 0x05:
-			gb->gb_reg.TIMA = val;
-			return;
+/* Turn off boot ROM */
+static void __gb_write_bios(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	gb->gb_bios_enable = 0;
+}
 
-		case 0x06:
-			gb->gb_reg.TMA = val;
-			return;
+/* Read only and unused registers. */
+static void __gb_write_invalid(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	(gb->gb_error)(gb, GB_INVALID_WRITE, addr);
+}
 
-		case 0x07:
-			gb->gb_reg.TAC = val;
-			return;
+static void (*const io_write[0x80])(struct gb_s*, const uint_fast16_t,
+		const uint8_t) =
+{
+	[0x00] = __gb_write_p1,
+	[0x02] = __gb_write_sc,
+	[0x03] = __gb_write_invalid,
+	[0x04] = __gb_write_div,
+	[0x05] = __gb_write_tima,
+	[0x07] = __gb_write_tac,
+	[0x08 ... 0x0E] = __gb_write_invalid,
+	[0x0F] = __gb_write_if,
+	[0x10 ... 0x3F] = __gb_write_apu,
+	[0x40] = __gb_write_lcdc,
+	[0x41] = __gb_write_stat,
+	[0x44] = __gb_write_invalid,
+	[0x46] = __gb_write_dma,
+	[0x47] = __gb_write_bgp,
+	[0x48] = __gb_write_obp0,
+	[0x49] = __gb_write_obp1,
+	[0x4C ... 0x4F] = __gb_write_invalid,
+	[0x50] = __gb_write_bios,
+	[0x51 ... 0x7F] = __gb_write_invalid
+};
 
-		/* Interrupt Flag Register */
-		case 0x0F:
-			gb->gb_reg.IF = (val | 0b11100000);
-			return;
+/**
+ * Internal function used to read IO registers, HRAM and IE.
+ */
+uint8_t __gb_read_io(struct gb_s *gb, const uint_fast16_t addr)
+{
+	const uint_fast8_t reg = addr - IO_ADDR;
 
-		/* LCD Registers */
-		case 0x40:
-			if(((gb->gb_reg.LCDC & LCDC_ENABLE) == 0) &&
-				(val & LCDC_ENABLE))
-			{
-				gb->counter.lcd_count = 0;
-				gb->lcd_blank = 1;
-			}
+	if(reg < 0x80 && io_read[reg] != NULL)
+		return io_read[reg](gb, addr);
 
-			gb->gb_reg.LCDC = val;
+	return gb->hram[reg];
+}
 
-			/* LY fixed to 0 when LCD turned off. */
-			if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
-			{
-				/* Do not turn off LCD outside of VBLANK. This may
-				 * happen due to poor timing in this emulator. */
-				if(gb->lcd_mode != LCD_VBLANK)
-				{
-					gb->gb_reg.LCDC |= LCDC_ENABLE;
-					return;
-				}
+/**
+ * Internal function used to write IO registers, HRAM and IE.
+ */
+void __gb_write_io(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val)
+{
+	const uint_fast8_t reg = addr - IO_ADDR;
 
-				gb->gb_reg.STAT = (gb->gb_reg.STAT & ~0x03) | LCD_VBLANK;
-				gb->gb_reg.LY = 0;
-				gb->counter.lcd_count = 0;
-			}
+	if(reg < 0x80 && io_write[reg] != NULL)
+	{
+		io_write[reg](gb, addr, val);
+		return;
+	}
 
-			return;
+	gb->hram[reg] = val;
 
-		case 0x41:
-			gb->gb_reg.STAT = (val & 0b01111000);
-			return;
+	/* Stop the CPU to check for interrupts. */
+	if(addr == INTR_EN_ADDR)
+		gb->counter.event_cycles = 0;
+}
 
-		case 0x42:
-			gb->gb_reg.SCY = val;
-			return;
+/**
+ * Internal function used to read bytes.
+ */
+uint8_t __gb_read(struct gb_s *gb, const uint_fast16_t addr)
+{
+	if(DMA_ACTIVE(gb) && addr < IO_ADDR)
+		return 0xFF;
 
-		case 0x43:
-			gb->gb_reg.SCX = val;
-			return;
+	switch(addr >> 12)
+	{
+	case 0x0:
+
+	/* TODO: BIOS support. */
+	case 0x1:
+	case 0x2:
+	case 0x3:
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		return gb->cart_read(gb, addr);
+
+	case 0x8:
+	case 0x9:
+		return gb->vram[addr - VRAM_ADDR];
+
+	case 0xA:
+	case 0xB:
+		return gb->cart_read(gb, addr);
+
+	case 0xC:
+		return gb->wram[addr - WRAM_0_ADDR];
+
+	case 0xD:
+		return gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE];
+
+	case 0xE:
+		return gb->wram[addr - ECHO_ADDR];
+
+	case 0xF:
+		if(addr >= IO_ADDR)
+			return __gb_read_io(gb, addr);
+
+		if(addr < OAM_ADDR)
+			return gb->wram[addr - ECHO_ADDR];
+
+		if(addr < UNUSED_ADDR)
+			return gb->oam[addr - OAM_ADDR];
+
+		/* Unusable memory area. Reading from this area returns 0.*/
+		return 0xFF;
+	}
+
+	(gb->gb_error)(gb, GB_INVALID_READ, addr);
+	return 0xFF;
+}
 
-		/* LY (0xFF44) is read only. */
-		case 0x45:
-			gb->gb_reg.LYC = val;
-			return;
+/**
+ * Internal function used to write bytes.
+ */
+void __gb_write(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val)
+{
+	if(DMA_ACTIVE(gb) && addr < IO_ADDR)
+		return;
 
-		/* DMA Register */
-		case 0x46:
-			gb->gb_reg.DMA = (val % 0xF1);
+#if PEANUT_GB_BLOCK_CACHE
+	/* The CPU may be running a cached block from the bank being switched
+	 * out, so have it stop and look up the next block again. */
+	if(addr < VRAM_ADDR)
+		gb->counter.event_cycles = 0;
+#endif
 
-			for(uint8_t i = 0; i < OAM_SIZE; i++)
-				gb->oam[i] = __gb_read(gb, (gb->gb_reg.DMA << 8) + i);
+	switch(addr >> 12)
+	{
+	case 0x0:
+	case 0x1:
+	case 0x2:
+	case 0x3:
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		gb->cart_write(gb, addr, val);
+		return;
 
+	case 0x8:
+	case 0x9:
+		/* Games often write the same map again, which changes nothing
+		 * worked out from VRAM. */
+		if(gb->vram[addr - VRAM_ADDR] == val)
 			return;
 
-		/* DMG Palette Registers */
-		case 0x47:
-			gb->gb_reg.BGP = val;
-			gb->display.bg_palette[0] = (gb->gb_reg.BGP & 0x03);
-			gb->display.bg_palette[1] = (gb->gb_reg.BGP >> 2) & 0x03;
-			gb->display.bg_palette[2] = (gb->gb_reg.BGP >> 4) & 0x03;
-			gb->display.bg_palette[3] = (gb->gb_reg.BGP >> 6) & 0x03;
-			return;
+		gb->vram[addr - VRAM_ADDR] = val;
+#if ENABLE_LCD
+		__gb_vram_written(gb, addr - VRAM_ADDR, 1);
+#endif
+		return;
 
-		case 0x48:
-			gb->gb_reg.OBP0 = val;
-			gb->display.sp_palette[0] = (gb->gb_reg.OBP0 & 0x03);
-			gb->display.sp_palette[1] = (gb->gb_reg.OBP0 >> 2) & 0x03;
-			gb->display.sp_palette[2] = (gb->gb_reg.OBP0 >> 4) & 0x03;
-			gb->display.sp_palette[3] = (gb->gb_reg.OBP0 >> 6) & 0x03;
-			return;
+	case 0xA:
+	case 0xB:
+		gb->cart_write(gb, addr, val);
+		return;
 
-		case 0x49:
-			gb->gb_reg.OBP1 = val;
-			gb->display.sp_palette[4] = (gb->gb_reg.OBP1 & 0x03);
-			gb->display.sp_palette[5] = (gb->gb_reg.OBP1 >> 2) & 0x03;
-			gb->display.sp_palette[6] = (gb->gb_reg.OBP1 >> 4) & 0x03;
-			gb->display.sp_palette[7] = (gb->gb_reg.OBP1 >> 6) & 0x03;
-			return;
+	case 0xC:
+		gb->wram[addr - WRAM_0_ADDR] = val;
+		return;
 
-		/* Window Position Registers */
-		case 0x4A:
-			gb->gb_reg.WY = val;
-			return;
+	case 0xD:
+		gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE] = val;
+		return;
+
+	case 0xE:
+		gb->wram[addr - ECHO_ADDR] = val;
+		return;
 
-		case 0x4B:
-			gb->gb_reg.WX = val;
+	case 0xF:
+		if(addr >= IO_ADDR)
+		{
+			__gb_write_io(gb, addr, val);
 			return;
+		}
 
-		/* Turn off boot ROM */
-		case 0x50:
-			gb->gb_bios_enable = 0;
+		if(addr < OAM_ADDR)
+		{
+			gb->wram[addr - ECHO_ADDR] = val;
 			return;
+		}
 
-		/* Interrupt Enable Register */
-		case 0xFF:
-			gb->gb_reg.IE = val;
+		if(addr < UNUSED_ADDR)
+		{
+			if(gb->oam[addr - OAM_ADDR] != val)
+			{
+				gb->oam[addr - OAM_ADDR] = val;
+				gb->display.sprites_dirty = 1;
+				gb->display.oam_version++;
+			}
 			return;
 		}
+
+		/* Unusable memory area. */
+		return;
 	}
 
 	(gb->gb_error)(gb, GB_INVALID_WRITE, addr);
@@ -526,51 +823,178 @@ void gb_set_rtc(struct gb_s *gb, const struct tm * const time)
 }
 
 #if ENABLE_LCD
-struct sprite_data {
-	uint8_t sprite_number;
-	uint8_t x;
-};
+/**
+ * Decode the tile data in VRAM from addr (relative to VRAM_ADDR) for len bytes
+ * into display.tiles. Bytes after the tile data are ignored.
+ */
+static void __gb_decode_tiles(struct gb_s *gb, const uint_fast16_t addr,
+		const uint_fast16_t len)
+{
+	const uint_fast16_t end = MIN(addr + len, NUM_TILES * 0x10);
 
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-static int compare_sprites(const void *in1, const void *in2)
+	/* Each row is stored as two bytes: the low bits of each pixel's colour,
+	 * then the high bits, with the leftmost pixel in bit 7. */
+	for(uint_fast16_t row = addr & ~1; row < end; row += 2)
+	{
+		const uint8_t t1 = gb->vram[row];
+		const uint8_t t2 = gb->vram[row + 1];
+		uint8_t *pixels = gb->display.tiles[row >> 4][(row >> 1) & 0x07];
+
+		for(uint_fast8_t px = 0; px < 8; px++)
+		{
+			pixels[px] = ((t1 >> (7 - px)) & 1) |
+				(((t2 >> (7 - px)) & 1) << 1);
+		}
+	}
+}
+
+void __gb_vram_written(struct gb_s *gb, const uint_fast16_t addr,
+		const uint_fast16_t len)
 {
-	const struct sprite_data *sd1 = in1, *sd2 = in2;
-	int x_res = (int)sd1->x - (int)sd2->x;
-	if(x_res != 0)
-		return x_res;
+	const uint_fast16_t end = addr + len;
 
-	return (int)sd1->sprite_number - (int)sd2->sprite_number;
+	__gb_decode_tiles(gb, addr, len);
+
+	for(uint_fast16_t a = addr & ~0x0F; a < MIN(end, VRAM_BMAP_1);
+			a += 0x10)
+		gb->display.tile_version[a >> 4]++;
+
+	for(uint_fast16_t a = addr < VRAM_BMAP_1 ? VRAM_BMAP_1 : addr & ~0x1F;
+			a < end; a += 0x20)
+		gb->display.map_version[(a - VRAM_BMAP_1) >> 5]++;
 }
-#endif
 
-void __gb_draw_line(struct gb_s *gb)
+/* Returns the background or window tile with map entry idx. */
+static inline uint_fast16_t __gb_bg_tile(struct gb_s *gb, const uint8_t idx)
 {
-	if(gb->direct.frame_skip && !gb->display.frame_skip_count)
-		return;
+	/* Select addressing mode. Without LCDC_TILE_SELECT, idx is signed and
+	 * relative to tile 256. */
+	return (gb->gb_reg.LCDC & LCDC_TILE_SELECT) ? idx : 0x100 + (int8_t) idx;
+}
 
-	/* If interlaced mode is activated, check if we need to draw the current
-	 * line. */
-	if(gb->direct.interlace)
+/* Returns row py of the background or window tile with map entry idx. */
+static inline const uint8_t *__gb_bg_tile_row(struct gb_s *gb,
+		const uint8_t idx, const uint8_t py)
+{
+	return gb->display.tiles[__gb_bg_tile(gb, idx)][py];
+}
+
+/* Returns whether the window is drawn on the current line. */
+static inline int __gb_window_on_line(struct gb_s *gb)
+{
+	return (gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE)
+		&& gb->gb_reg.LY >= gb->display.WY
+		&& gb->gb_reg.WX <= 166;
+}
+
+/**
+ * Rebuild the list of sprites on each line from OAM. With
+ * PEANUT_GB_HIGH_LCD_ACCURACY, sprites are prioritised by X coordinate then
+ * location in OAM, and only the first 10 on a line are kept. Otherwise,
+ * location in OAM alone decides priority.
+ */
+static void __gb_sort_sprites(struct gb_s *gb)
+{
+	const uint8_t height = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE) ? 16 : 8;
+	uint8_t order[NUM_SPRITES];
+
+	for(uint8_t i = 0; i < NUM_SPRITES; i++)
 	{
-		if((gb->display.interlace_count == 0
-				&& (gb->gb_reg.LY & 1) == 0)
-				|| (gb->display.interlace_count == 1
-				    && (gb->gb_reg.LY & 1) == 1))
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+		/* Insertion sort by X, which keeps equal sprites in OAM
+		 * order. */
+		const uint8_t x = gb->oam[4 * i + 1];
+		uint8_t j = i;
+
+		for(; j > 0 && gb->oam[4 * order[j - 1] + 1] > x; j--)
+			order[j] = order[j - 1];
+
+		order[j] = i;
+#else
+		order[i] = i;
+#endif
+	}
+
+	memset(gb->display.line_sprite_count, 0,
+			sizeof(gb->display.line_sprite_count));
+
+	/* Add sprites to the lines they cover in priority order, so that the
+	 * limit drops those with the lowest priority. */
+	for(uint8_t i = 0; i < NUM_SPRITES; i++)
+	{
+		const uint8_t s = order[i];
+		/* A sprite covers the lines from OY - 16. */
+		const int top = gb->oam[4 * s + 0] - 16;
+		const int end = MIN(top + height, LCD_HEIGHT);
+
+		for(int ly = top < 0 ? 0 : top; ly < end; ly++)
 		{
-			/* Compensate for missing window draw if required. */
-			if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
-					&& gb->gb_reg.LY >= gb->display.WY
-					&& gb->gb_reg.WX <= 166)
-				gb->display.window_clear++;
+			uint8_t *count = &gb->display.line_sprite_count[ly];
 
-			return;
+			if(*count < LINE_SPRITES)
+				gb->display.line_sprites[ly][(*count)++] = s;
 		}
 	}
-	
-	uint8_t* front_pixels = &gb->display.front_fb[gb->gb_reg.LY][0];
-	uint8_t* back_pixels = &gb->display.back_fb[gb->gb_reg.LY][0];
-	uint8_t* pixels = gb->display.back_fb_enabled ? back_pixels : front_pixels;
-	uint8_t pixel = 0;
+
+	gb->display.sprites_dirty = 0;
+}
+
+/* Dither the line drawn to pixels into the frame set by gb_set_dither(). */
+static void __gb_dither_line(struct gb_s *gb, const uint8_t *pixels)
+{
+	for(uint_fast8_t i = 0; i < 2; i++)
+	{
+		const uint_fast8_t y = gb->display.dither.rows[gb->gb_reg.LY][i];
+		const uint8_t *pat;
+		uint8_t *out;
+
+		if(y == GB_DITHER_NO_ROW)
+			continue;
+
+		pat = gb->display.dither.patterns[y & 3];
+		out = gb->display.dither.frame + y * gb->display.dither.stride +
+			gb->display.dither.x;
+
+		/* Each bit takes its column's bit of the pattern for the shade
+		 * of the pixel that covers it. */
+		if(gb->display.dither.scale == 1)
+		{
+			for(uint_fast8_t px = 0; px < LCD_WIDTH; px += 8)
+			{
+				*out++ = (pat[pixels[px + 0] & 3] & 0x80) |
+					(pat[pixels[px + 1] & 3] & 0x40) |
+					(pat[pixels[px + 2] & 3] & 0x20) |
+					(pat[pixels[px + 3] & 3] & 0x10) |
+					(pat[pixels[px + 4] & 3] & 0x08) |
+					(pat[pixels[px + 5] & 3] & 0x04) |
+					(pat[pixels[px + 6] & 3] & 0x02) |
+					(pat[pixels[px + 7] & 3] & 0x01);
+			}
+		}
+		else
+		{
+			for(uint_fast8_t px = 0; px < LCD_WIDTH; px += 4)
+			{
+				*out++ = (pat[pixels[px + 0] & 3] & 0xC0) |
+					(pat[pixels[px + 1] & 3] & 0x30) |
+					(pat[pixels[px + 2] & 3] & 0x0C) |
+					(pat[pixels[px + 3] & 3] & 0x03);
+			}
+		}
+	}
+}
+
+/* Draw the current line to pixels. */
+static void __gb_render_line(struct gb_s *gb, uint8_t *pixels)
+{
+	/* Background and window colours, copied so that writes to pixels do
+	 * not force them to be reloaded. */
+	const uint8_t bg_palette[4] = {
+		gb->display.bg_palette[0],
+		gb->display.bg_palette[1],
+		gb->display.bg_palette[2],
+		gb->display.bg_palette[3]
+	};
 
 	/* If background is enabled, draw it. */
 	if(gb->gb_reg.LCDC & LCDC_BG_ENABLE)
@@ -589,63 +1013,32 @@ void __gb_draw_line(struct gb_s *gb)
 			 VRAM_BMAP_2 : VRAM_BMAP_1)
 			+ (bg_y >> 3) * 0x20;
 
-		/* The displays (what the player sees) X coordinate, drawn right
-		 * to left. */
-		uint8_t disp_x = LCD_WIDTH - 1;
-
-		/* The X coordinate to begin drawing the background at. */
-		uint8_t bg_x = disp_x + gb->gb_reg.SCX;
-
-		/* Get tile index for current background tile. */
-		uint8_t idx = gb->vram[bg_map + (bg_x >> 3)];
 		/* Y coordinate of tile pixel to draw. */
 		const uint8_t py = (bg_y & 0x07);
-		/* X coordinate of tile pixel to draw. */
-		uint8_t px = 7 - (bg_x & 0x07);
-
-		uint16_t tile;
 
-		/* Select addressing mode. */
-		if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-			tile = VRAM_TILES_1 + idx * 0x10;
-		else
-			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+		/* The displays (what the player sees) X coordinate. */
+		uint8_t disp_x = 0;
 
-		tile += 2 * py;
+		while(disp_x < LCD_WIDTH)
+		{
+			/* The X coordinate of the background at disp_x. */
+			const uint8_t bg_x = disp_x + gb->gb_reg.SCX;
+			const uint8_t *row = __gb_bg_tile_row(gb,
+					gb->vram[bg_map + (bg_x >> 3)], py);
 
-		/* fetch first tile */
-		uint8_t t1 = gb->vram[tile] >> px;
-		uint8_t t2 = gb->vram[tile + 1] >> px;
+			/* Copy the rest of the tile's row. */
+			const uint8_t px = bg_x & 0x07;
+			const uint8_t n = MIN(8 - px, LCD_WIDTH - disp_x);
 
-		for(; disp_x != 0xFF; disp_x--)
-		{
-			if(px == 8)
-			{
-				/* fetch next tile */
-				px = 0;
-				bg_x = disp_x + gb->gb_reg.SCX;
-				idx = gb->vram[bg_map + (bg_x >> 3)];
-
-				if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-					tile = VRAM_TILES_1 + idx * 0x10;
-				else
-					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-				tile += 2 * py;
-				t1 = gb->vram[tile];
-				t2 = gb->vram[tile + 1];
-			}
+			for(uint8_t i = 0; i < n; i++)
+				pixels[disp_x + i] = bg_palette[row[px + i]];
 
-			/* copy background */
-			uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-			pixel = gb->display.bg_palette[c];
-			pixel |= LCD_PALETTE_BG;
-			pixels[disp_x] = pixel;
-			t1 = t1 >> 1;
-			t2 = t2 >> 1;
-			px++;
+			disp_x += n;
 		}
 	}
+	/* Otherwise the background is white. */
+	else
+		memset(pixels, 0, LCD_WIDTH);
 
 	/* draw window */
 	if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
@@ -657,57 +1050,24 @@ void __gb_draw_line(struct gb_s *gb)
 				    VRAM_BMAP_2 : VRAM_BMAP_1;
 		win_line += (gb->display.window_clear >> 3) * 0x20;
 
-		uint8_t disp_x = LCD_WIDTH - 1;
-		uint8_t win_x = disp_x - gb->gb_reg.WX + 7;
-
-		// look up tile
-		uint8_t py = gb->display.window_clear & 0x07;
-		uint8_t px = 7 - (win_x & 0x07);
-		uint8_t idx = gb->vram[win_line + (win_x >> 3)];
-
-		uint16_t tile;
-
-		if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-			tile = VRAM_TILES_1 + idx * 0x10;
-		else
-			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-		tile += 2 * py;
+		const uint8_t py = gb->display.window_clear & 0x07;
+		uint8_t disp_x = (gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7);
 
-		// fetch first tile
-		uint8_t t1 = gb->vram[tile] >> px;
-		uint8_t t2 = gb->vram[tile + 1] >> px;
+		while(disp_x < LCD_WIDTH)
+		{
+			/* The X coordinate of the window at disp_x. */
+			const uint8_t win_x = disp_x - gb->gb_reg.WX + 7;
+			const uint8_t *row = __gb_bg_tile_row(gb,
+					gb->vram[win_line + (win_x >> 3)], py);
 
-		// loop & copy window
-		uint8_t end = (gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7) - 1;
+			/* Copy the rest of the tile's row. */
+			const uint8_t px = win_x & 0x07;
+			const uint8_t n = MIN(8 - px, LCD_WIDTH - disp_x);
 
-		for(; disp_x != end; disp_x--)
-		{
-			if(px == 8)
-			{
-				// fetch next tile
-				px = 0;
-				win_x = disp_x - gb->gb_reg.WX + 7;
-				idx = gb->vram[win_line + (win_x >> 3)];
-
-				if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-					tile = VRAM_TILES_1 + idx * 0x10;
-				else
-					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-				tile += 2 * py;
-				t1 = gb->vram[tile];
-				t2 = gb->vram[tile + 1];
-			}
+			for(uint8_t i = 0; i < n; i++)
+				pixels[disp_x + i] = bg_palette[row[px + i]];
 
-			// copy window
-			uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-			pixel = gb->display.bg_palette[c];
-			pixel |= LCD_PALETTE_BG;
-			pixels[disp_x] = pixel;
-			t1 = t1 >> 1;
-			t2 = t2 >> 1;
-			px++;
+			disp_x += n;
 		}
 
 		gb->display.window_clear++; // advance window line
@@ -716,57 +1076,16 @@ void __gb_draw_line(struct gb_s *gb)
 	// draw sprites
 	if(gb->gb_reg.LCDC & LCDC_OBJ_ENABLE)
 	{
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-		uint8_t number_of_sprites = 0;
-		struct sprite_data sprites_to_render[NUM_SPRITES];
-
-		/* Record number of sprites on the line being rendered, limited
-		 * to the maximum number sprites that the Game Boy is able to
-		 * render on each line (10 sprites). */
-		for(uint8_t sprite_number = 0;
-				sprite_number < PEANUT_GB_ARRAYSIZE(sprites_to_render);
-				sprite_number++)
-		{
-			/* Sprite Y position. */
-			uint8_t OY = gb->oam[4 * sprite_number + 0];
-			/* Sprite X position. */
-			uint8_t OX = gb->oam[4 * sprite_number + 1];
+		const uint8_t *sprites = gb->display.line_sprites[gb->gb_reg.LY];
 
-			/* If sprite isn't on this line, continue. */
-			if (gb->gb_reg.LY +
-				(gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >= OY
-					|| gb->gb_reg.LY + 16 < OY)
-				continue;
-
-
-			sprites_to_render[number_of_sprites].sprite_number = sprite_number;
-			sprites_to_render[number_of_sprites].x = OX;
-			number_of_sprites++;
-		}
-
-		/* If maximum number of sprites reached, prioritise X
-		 * coordinate and object location in OAM. */
-		qsort(&sprites_to_render[0], number_of_sprites,
-				sizeof(sprites_to_render[0]), compare_sprites);
-		if(number_of_sprites > MAX_SPRITES_LINE)
-			number_of_sprites = MAX_SPRITES_LINE;
-#endif
+		if(gb->display.sprites_dirty)
+			__gb_sort_sprites(gb);
 
 		/* Render each sprite, from low priority to high priority. */
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-		/* Render the top ten prioritised sprites on this scanline. */
-		for(uint8_t sprite_number = number_of_sprites - 1;
-				sprite_number != 0xFF;
-				sprite_number--)
-		{
-			uint8_t s = sprites_to_render[sprite_number].sprite_number;
-#else
-		for (uint8_t sprite_number = NUM_SPRITES - 1;
-			sprite_number != 0xFF;
-			sprite_number--)
+		for(uint8_t i = gb->display.line_sprite_count[gb->gb_reg.LY];
+				i-- != 0;)
 		{
-			uint8_t s = sprite_number;
-#endif
+			uint8_t s = sprites[i];
 			/* Sprite Y position. */
 			uint8_t OY = gb->oam[4 * s + 0];
 			/* Sprite X position. */
@@ -777,14 +1096,6 @@ void __gb_draw_line(struct gb_s *gb)
 			/* Additional attributes. */
 			uint8_t OF = gb->oam[4 * s + 3];
 
-#if !PEANUT_GB_HIGH_LCD_ACCURACY
-			/* If sprite isn't on this line, continue. */
-			if(gb->gb_reg.LY +
-					(gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >= OY ||
-					gb->gb_reg.LY + 16 < OY)
-				continue;
-#endif
-
 			/* Continue if sprite not visible. */
 			if(OX == 0 || OX >= 168)
 				continue;
@@ -795,35 +1106,19 @@ void __gb_draw_line(struct gb_s *gb)
 			if(OF & OBJ_FLIP_Y)
 				py = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 15 : 7) - py;
 
-			// fetch the tile
-			uint8_t t1 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py];
-			uint8_t t2 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py + 1];
-
-			// handle x flip
-			uint8_t dir, start, end, shift;
+			// fetch the tile row. The lower half of an 8x16 sprite is
+			// the next tile.
+			const uint8_t *row = gb->display.tiles[OT + (py >> 3)][py & 0x07];
 
-			if(OF & OBJ_FLIP_X)
-			{
-				dir = 1;
-				start = (OX < 8 ? 0 : OX - 8);
-				end = MIN(OX, LCD_WIDTH);
-				shift = 8 - OX + start;
-			}
-			else
-			{
-				dir = -1;
-				start = MIN(OX, LCD_WIDTH) - 1;
-				end = (OX < 8 ? 0 : OX - 8) - 1;
-				shift = OX - (start + 1);
-			}
+			// handle x flip, by reading the row backwards
+			const uint8_t flip = (OF & OBJ_FLIP_X) ? 7 : 0;
+			const uint8_t start = (OX < 8 ? 0 : OX - 8);
+			const uint8_t end = MIN(OX, LCD_WIDTH);
 
 			// copy tile
-			t1 >>= shift;
-			t2 >>= shift;
-
-			for(uint8_t disp_x = start; disp_x != end; disp_x += dir)
+			for(uint8_t disp_x = start; disp_x != end; disp_x++)
 			{
-				uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+				uint8_t c = row[(disp_x + 8 - OX) ^ flip];
 				// check transparency / sprite overlap / background overlap
 #if 0
 
@@ -838,87 +1133,220 @@ void __gb_draw_line(struct gb_s *gb)
 #endif
 				{
 					/* Set pixel colour. */
-					pixel = (OF & OBJ_PALETTE)
+					pixels[disp_x] = (OF & OBJ_PALETTE)
 							 ? gb->display.sp_palette[c + 4]
 							 : gb->display.sp_palette[c];
-					/* Set pixel palette (OBJ0 or OBJ1). */
-					pixel |= (OF & OBJ_PALETTE);
-					/* Deselect BG palette. */
-					pixel &= ~LCD_PALETTE_BG;
-					pixels[disp_x] = pixel;
 				}
-
-				t1 = t1 >> 1;
-				t2 = t2 >> 1;
 			}
 		}
 	}
+}
 
-	/* If LCD not initialised by front-end, don't render anything. */
-	if(memcmp(front_pixels, back_pixels, LCD_WIDTH) != 0) {
-		gb->display.changed_rows[gb->gb_reg.LY] = 1;
-		gb->display.changed_row_count++;
+/**
+ * Returns the sum of the versions of the tiles used by the current line. A line
+ * may use a few more tiles than it shows.
+ */
+static uint32_t __gb_line_tiles(struct gb_s *gb)
+{
+	uint32_t tiles = 0;
+
+	if(gb->gb_reg.LCDC & LCDC_BG_ENABLE)
+	{
+		const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
+		const uint8_t *map = &gb->vram[((gb->gb_reg.LCDC & LCDC_BG_MAP) ?
+				VRAM_BMAP_2 : VRAM_BMAP_1) + (bg_y >> 3) * 0x20];
+
+		for(uint_fast8_t i = 0; i <= LCD_WIDTH / 8; i++)
+		{
+			const uint8_t idx = map[((gb->gb_reg.SCX >> 3) + i) & 0x1F];
+			tiles += gb->display.tile_version[__gb_bg_tile(gb, idx)];
+		}
+	}
+
+	if(__gb_window_on_line(gb))
+	{
+		const uint8_t *map = &gb->vram[((gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ?
+				VRAM_BMAP_2 : VRAM_BMAP_1) +
+			(gb->display.window_clear >> 3) * 0x20];
+
+		/* The last pixel shown is at 166 - WX in the window. */
+		for(uint_fast8_t i = 0; i <= (166 - gb->gb_reg.WX) >> 3; i++)
+			tiles += gb->display.tile_version[__gb_bg_tile(gb, map[i])];
+	}
+
+	if(gb->gb_reg.LCDC & LCDC_OBJ_ENABLE)
+	{
+		const uint8_t *sprites = gb->display.line_sprites[gb->gb_reg.LY];
+		const uint8_t tall = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE) != 0;
+
+		if(gb->display.sprites_dirty)
+			__gb_sort_sprites(gb);
+
+		for(uint_fast8_t i = 0;
+				i < gb->display.line_sprite_count[gb->gb_reg.LY]; i++)
+		{
+			const uint8_t OT = gb->oam[4 * sprites[i] + 2] & ~tall;
+
+			tiles += gb->display.tile_version[OT];
+			if(tall)
+				tiles += gb->display.tile_version[OT + 1];
+		}
 	}
+
+	return tiles;
 }
-#endif
 
-void __gb_step(struct gb_s *gb)
+/**
+ * Work out what the current line is drawn from, and record it. Returns whether
+ * the line must be drawn, rather than left as it was last drawn.
+ */
+static int __gb_line_inputs_changed(struct gb_s *gb)
 {
-    /* Handle interrupts */
-	if((gb->gb_ime || gb->gb_halt) &&
-			(gb->gb_reg.IF & gb->gb_reg.IE & ANY_INTR))
+	struct gb_line_inputs_s *last = &gb->display.line_inputs[gb->gb_reg.LY];
+	const uint8_t drawn = gb->display.line_drawn[gb->gb_reg.LY];
+	struct gb_line_inputs_s in;
+	uint32_t tiles;
+	int same;
+
+	memset(&in, 0, sizeof(in));
+	in.versions = gb->display.oam_version;
+	in.tiles = last->tiles;
+	in.LCDC = gb->gb_reg.LCDC;
+	in.SCY = gb->gb_reg.SCY;
+	in.SCX = gb->gb_reg.SCX;
+	in.WY = gb->display.WY;
+	in.WX = gb->gb_reg.WX;
+	in.window_line = gb->display.window_clear;
+	in.BGP = gb->gb_reg.BGP;
+	in.OBP0 = gb->gb_reg.OBP0;
+	in.OBP1 = gb->gb_reg.OBP1;
+
+	if(in.LCDC & LCDC_BG_ENABLE)
 	{
-		gb->gb_halt = 0;
+		const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
+		in.versions += gb->display.map_version[
+			((in.LCDC & LCDC_BG_MAP) ? 32 : 0) + (bg_y >> 3)];
+	}
 
-		if(gb->gb_ime)
-		{
-			/* Disable interrupts */
-			gb->gb_ime = 0;
+	if(__gb_window_on_line(gb))
+	{
+		in.versions += gb->display.map_version[
+			((in.LCDC & LCDC_WINDOW_MAP) ? 32 : 0) +
+			(in.window_line >> 3)];
+	}
 
-			/* Push Program Counter */
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
+	same = memcmp(&in, last, sizeof(in)) == 0;
+	*last = in;
 
-			/* Call interrupt handler if required. */
-			if(gb->gb_reg.IF & gb->gb_reg.IE & VBLANK_INTR)
-			{
-				gb->cpu_reg.pc = VBLANK_INTR_ADDR;
-				gb->gb_reg.IF ^= VBLANK_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & LCDC_INTR)
-			{
-				gb->cpu_reg.pc = LCDC_INTR_ADDR;
-				gb->gb_reg.IF ^= LCDC_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & TIMER_INTR)
-			{
-				gb->cpu_reg.pc = TIMER_INTR_ADDR;
-				gb->gb_reg.IF ^= TIMER_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & SERIAL_INTR)
-			{
-				gb->cpu_reg.pc = SERIAL_INTR_ADDR;
-				gb->gb_reg.IF ^= SERIAL_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & CONTROL_INTR)
-			{
-				gb->cpu_reg.pc = CONTROL_INTR_ADDR;
-				gb->gb_reg.IF ^= CONTROL_INTR;
-			}
+	/* Lines that scroll change every frame, so the tiles are only summed
+	 * once everything else is the same, and the line is drawn again until
+	 * they have been. */
+	if(!same)
+	{
+		gb->display.line_drawn[gb->gb_reg.LY] = 0;
+		return 1;
+	}
+
+	/* With the same map rows, the same tiles are used, and the sum of
+	 * their versions only stays the same if none of them were written. */
+	tiles = __gb_line_tiles(gb);
+	same = drawn && tiles == last->tiles;
+	last->tiles = tiles;
+	gb->display.line_drawn[gb->gb_reg.LY] = 1;
+
+	return !same;
+}
+
+void __gb_draw_line(struct gb_s *gb)
+{
+	if(gb->direct.frame_skip && !gb->display.frame_skip_count)
+		return;
+
+	/* If interlaced mode is activated, check if we need to draw the current
+	 * line. */
+	if(gb->direct.interlace)
+	{
+		if((gb->display.interlace_count == 0
+				&& (gb->gb_reg.LY & 1) == 0)
+				|| (gb->display.interlace_count == 1
+				    && (gb->gb_reg.LY & 1) == 1))
+		{
+			/* Compensate for missing window draw if required. */
+			if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
+					&& gb->gb_reg.LY >= gb->display.WY
+					&& gb->gb_reg.WX <= 166)
+				gb->display.window_clear++;
+
+			return;
 		}
 	}
-    
-	uint8_t inst_cycles = __gb_step_chunked(&gb->cpu_reg);
 	
-	/* DIV register timing */
-	gb->counter.div_count += inst_cycles;
+	uint8_t pixels[LCD_WIDTH];
+	uint8_t packed[LCD_WIDTH / 4];
+	uint8_t *fb = gb->display.fb[gb->gb_reg.LY];
+
+	/* The line is the same as when it was last drawn, and is still in
+	 * the frame buffer. */
+	if(!__gb_line_inputs_changed(gb))
+	{
+		if(__gb_window_on_line(gb))
+			gb->display.window_clear++;
+
+		return;
+	}
+
+	__gb_render_line(gb, pixels);
+
+	/* Pack the shades four to a byte, leftmost in the top bits. Read
+	 * four pixels at a time (little endian, as the registers are), and
+	 * multiply to move each shade into the top byte. */
+	for(uint_fast8_t i = 0; i < LCD_WIDTH / 4; i++)
+	{
+		uint32_t p;
+		memcpy(&p, &pixels[4 * i], sizeof(p));
+		packed[i] = ((p & 0x03030303) * 0x40100401) >> 24;
+	}
+
+	if(memcmp(fb, packed, sizeof(packed)) != 0) {
+		memcpy(fb, packed, sizeof(packed));
+		gb->display.changed_rows[gb->gb_reg.LY >> 5] |=
+			1u << (gb->gb_reg.LY & 31);
+		gb->display.changed_row_count++;
+
+		if(gb->display.dither.frame != NULL)
+			__gb_dither_line(gb, pixels);
+	}
+}
+#endif
+/**
+ * Advance serial, TIMA and the LCD by the number of cycles run since events
+ * were last processed. DIV is worked out from counter.time when read.
+ */
+static void __gb_run_events(struct gb_s *gb)
+{
+	const uint_fast32_t cycles = gb->counter.cycles;
 
-	if(gb->counter.div_count >= DIV_CYCLES)
+	gb->counter.cycles = 0;
+	gb->counter.time += cycles;
+#if PEANUT_GB_IDLE_LOOP_SKIP
+	/* Values polled by a loop may change from here. */
+	gb->idle.jr_addr = 0xFFFF;
+#endif
+
+#if PEANUT_GB_DMA_TIMING
+	/* End of OAM DMA. */
+	if(gb->counter.dma_count)
 	{
-		gb->gb_reg.DIV++;
-		gb->counter.div_count -= DIV_CYCLES;
+		if(cycles < gb->counter.dma_count)
+			gb->counter.dma_count -= cycles;
+		else
+		{
+			gb->counter.dma_count = 0;
+			__gb_map_pages(gb);
+		}
 	}
 
+#endif
 	/* Check serial transmission. */
 	if(gb->gb_reg.SC & SERIAL_SC_TX_START)
 	{
@@ -926,7 +1354,7 @@ void __gb_step(struct gb_s *gb)
 		if(gb->counter.serial_count == 0 && gb->gb_serial_tx != NULL)
 			(gb->gb_serial_tx)(gb, gb->gb_reg.SB);
 
-		gb->counter.serial_count += inst_cycles;
+		gb->counter.serial_count += cycles;
 
 		/* If it's time to receive byte, call RX function. */
 		if(gb->counter.serial_count >= SERIAL_CYCLES)
@@ -972,30 +1400,44 @@ void __gb_step(struct gb_s *gb)
 	/* TODO: Change tac_enable to struct of TAC timer control bits. */
 	if(gb->gb_reg.tac_enable)
 	{
-		static const uint_fast16_t TAC_CYCLES[4] = {1024, 16, 64, 256};
+		const uint_fast16_t tac_cycles = TAC_CYCLES[gb->gb_reg.tac_rate];
+		uint_fast32_t ticks;
 
-		gb->counter.tima_count += inst_cycles;
+		gb->counter.tima_count += cycles;
+		ticks = gb->counter.tima_count / tac_cycles;
+		gb->counter.tima_count %= tac_cycles;
 
-		while(gb->counter.tima_count >= TAC_CYCLES[gb->gb_reg.tac_rate])
+		/* Only overflows are scheduled, so TIMA may have been
+		 * incremented many times since the last event. */
+		while(ticks >= 0x100u - gb->gb_reg.TIMA)
 		{
-			gb->counter.tima_count -= TAC_CYCLES[gb->gb_reg.tac_rate];
-
-			if(++gb->gb_reg.TIMA == 0)
-			{
-				gb->gb_reg.IF |= TIMER_INTR;
-				/* On overflow, set TMA to TIMA. */
-				gb->gb_reg.TIMA = gb->gb_reg.TMA;
-			}
+			ticks -= 0x100u - gb->gb_reg.TIMA;
+			gb->gb_reg.IF |= TIMER_INTR;
+			/* On overflow, set TMA to TIMA. */
+			gb->gb_reg.TIMA = gb->gb_reg.TMA;
 		}
+
+		gb->gb_reg.TIMA += ticks;
 	}
 
 	/* TODO Check behaviour of LCD during LCD power off state. */
-	/* If LCD is off, don't update LCD state. */
+	/* If LCD is off, don't update LCD state. A frame still ends every
+	 * LCD_FRAME_CYCLES, so that gb_run_frame() returns. */
 	if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
+	{
+		gb->counter.lcd_count += cycles;
+
+		if(gb->counter.lcd_count >= LCD_FRAME_CYCLES)
+		{
+			gb->counter.lcd_count -= LCD_FRAME_CYCLES;
+			gb->gb_frame = 1;
+		}
+
 		return;
+	}
 
 	/* LCD Timing */
-	gb->counter.lcd_count += inst_cycles;
+	gb->counter.lcd_count += cycles;
 
 	/* New Scanline */
 	if(gb->counter.lcd_count > LCD_LINE_CYCLES)
@@ -1047,13 +1489,6 @@ void __gb_step(struct gb_s *gb)
 				gb->display.interlace_count =
 					!gb->display.interlace_count;
 			}
-			
-			if(!gb->direct.frame_skip ||
-				 !gb->display.frame_skip_count)
-			{
-					gb->display.back_fb_enabled =
-							!gb->display.back_fb_enabled;
-			}
 
 #endif
 		}
@@ -1094,17 +1529,310 @@ void __gb_step(struct gb_s *gb)
 	}
 }
 
+/**
+ * Work out how many cycles can be run before serial, TIMA or the LCD next
+ * change state, or gb_run_cycles() has to return, so that the CPU can run
+ * straight up until then.
+ */
+static void __gb_schedule_events(struct gb_s *gb)
+{
+	uint_fast32_t next = UINT_FAST32_MAX;
+
+	if(gb->gb_reg.SC & SERIAL_SC_TX_START)
+		next = MIN(next, SERIAL_CYCLES - gb->counter.serial_count);
+
+#if PEANUT_GB_DMA_TIMING
+	if(gb->counter.dma_count)
+		next = MIN(next, gb->counter.dma_count);
+#endif
+
+	/* TIMA overflow. __gb_run_events() leaves tima_count below
+	 * tac_cycles. */
+	if(gb->gb_reg.tac_enable)
+	{
+		const uint_fast16_t tac_cycles = TAC_CYCLES[gb->gb_reg.tac_rate];
+
+		next = MIN(next, (0x100u - gb->gb_reg.TIMA) * tac_cycles -
+				gb->counter.tima_count);
+	}
+
+	if(gb->gb_reg.LCDC & LCDC_ENABLE)
+	{
+		uint_fast16_t lcd_next = LCD_LINE_CYCLES + 1;
+
+		if(gb->lcd_mode == LCD_HBLANK)
+			lcd_next = LCD_MODE_2_CYCLES;
+		else if(gb->lcd_mode == LCD_SEARCH_OAM)
+			lcd_next = LCD_MODE_3_CYCLES;
+
+		if(gb->counter.lcd_count >= lcd_next)
+			next = 0;
+		else
+			next = MIN(next, lcd_next - gb->counter.lcd_count);
+	}
+	else
+		next = MIN(next, LCD_FRAME_CYCLES - gb->counter.lcd_count);
+
+	if(gb->counter.stop_time > gb->counter.time)
+		next = MIN(next, gb->counter.stop_time - gb->counter.time);
+
+	gb->counter.event_cycles = next;
+}
+
+static void __gb_interrupt(struct gb_s *gb)
+{
+	/* Handle interrupts */
+	if((gb->gb_ime || gb->gb_halt) &&
+			(gb->gb_reg.IF & gb->gb_reg.IE & ANY_INTR))
+	{
+		gb->gb_halt = 0;
+
+		if(gb->gb_ime)
+		{
+			/* Disable interrupts */
+			gb->gb_ime = 0;
+
+			/* Push Program Counter */
+			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
+			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
+
+			/* Call interrupt handler if required. */
+			if(gb->gb_reg.IF & gb->gb_reg.IE & VBLANK_INTR)
+			{
+				gb->cpu_reg.pc = VBLANK_INTR_ADDR;
+				gb->gb_reg.IF ^= VBLANK_INTR;
+			}
+			else if(gb->gb_reg.IF & gb->gb_reg.IE & LCDC_INTR)
+			{
+				gb->cpu_reg.pc = LCDC_INTR_ADDR;
+				gb->gb_reg.IF ^= LCDC_INTR;
+			}
+			else if(gb->gb_reg.IF & gb->gb_reg.IE & TIMER_INTR)
+			{
+				gb->cpu_reg.pc = TIMER_INTR_ADDR;
+				gb->gb_reg.IF ^= TIMER_INTR;
+			}
+			else if(gb->gb_reg.IF & gb->gb_reg.IE & SERIAL_INTR)
+			{
+				gb->cpu_reg.pc = SERIAL_INTR_ADDR;
+				gb->gb_reg.IF ^= SERIAL_INTR;
+			}
+			else if(gb->gb_reg.IF & gb->gb_reg.IE & CONTROL_INTR)
+			{
+				gb->cpu_reg.pc = CONTROL_INTR_ADDR;
+				gb->gb_reg.IF ^= CONTROL_INTR;
+			}
+		}
+	}
+}
+
+#if PEANUT_GB_IDLE_LOOP_SKIP
+/**
+ * Returns whether a value read from this address can only change through an
+ * event, an interrupt or a write by the CPU. The APU registers are excluded as
+ * the sound hardware updates them as it plays, and DIV and TIMA as they are
+ * worked out from the time when read.
+ */
+static uint_fast8_t __gb_idle_addr(const uint_fast16_t addr)
+{
+	return (addr < 0xFF10 || addr > 0xFF3F) &&
+		addr != 0xFF04 && addr != 0xFF05;
+}
+
+/**
+ * Works out whether the loop from target up to and including the JR at
+ * jr_addr does nothing but poll memory, so that every iteration computes the
+ * same result until an event or interrupt occurs.
+ *
+ * \returns	Cycles taken by one iteration, or 0 if the loop cannot be
+ *		skipped.
+ */
+static uint_fast8_t __gb_idle_loop_cycles(struct gb_s *gb,
+		uint_fast16_t addr, const uint_fast16_t jr_addr)
+{
+	/* Taken JR. */
+	uint_fast8_t cycles = 12;
+	/* Whether A has been loaded from memory yet. A may only be used
+	 * after it is loaded, otherwise the loop may not settle. */
+	uint_fast8_t loaded = 0;
+
+	if(addr > jr_addr || jr_addr - addr > IDLE_LOOP_MAX_LEN)
+		return 0;
+
+	while(addr < jr_addr)
+	{
+		const uint8_t opcode = __gb_read(gb, addr);
+
+		switch(opcode)
+		{
+		case 0x00: /* NOP */
+			cycles += 4;
+			addr += 1;
+			break;
+
+		case 0xF0: /* LD A, (0xFF00+imm) */
+			if(!__gb_idle_addr(0xFF00 | __gb_read(gb, addr + 1)))
+				return 0;
+
+			loaded = 1;
+			cycles += 12;
+			addr += 2;
+			break;
+
+		case 0xFA: /* LD A, (imm) */
+			if(!__gb_idle_addr(__gb_read(gb, addr + 1) |
+					(__gb_read(gb, addr + 2) << 8)))
+				return 0;
+
+			loaded = 1;
+			cycles += 16;
+			addr += 3;
+			break;
+
+		case 0xA7: /* AND A */
+		case 0xB7: /* OR A */
+			if(!loaded)
+				return 0;
+
+			cycles += 4;
+			addr += 1;
+			break;
+
+		case 0xE6: /* AND imm */
+		case 0xEE: /* XOR imm */
+		case 0xF6: /* OR imm */
+		case 0xFE: /* CP imm */
+			if(!loaded)
+				return 0;
+
+			cycles += 8;
+			addr += 2;
+			break;
+
+		case 0xCB: /* BIT b, A */
+			if(!loaded || (__gb_read(gb, addr + 1) & 0xC7) != 0x47)
+				return 0;
+
+			cycles += 8;
+			addr += 2;
+			break;
+
+		default:
+			return 0;
+		}
+	}
+
+	/* The last instruction must end where the JR starts. */
+	if(addr != jr_addr)
+		return 0;
+
+	return cycles;
+}
+
+/**
+ * Called by the CPU when a backward JR at jr_addr is taken. If the loop has
+ * done nothing but poll memory since the last time the JR was taken, the
+ * polled values cannot change until the next event, so the iterations up to
+ * then are skipped in one go.
+ */
+void __gb_idle_loop(struct gb_s *gb, const uint_fast16_t target,
+		const uint_fast16_t jr_addr)
+{
+	const uint16_t bank = jr_addr < ROM_N_ADDR ? 0 : __gb_rom_bank(gb);
+	uint_fast8_t loop_cycles;
+
+	/* Only loops in ROM are considered, as code in RAM may change. */
+	if(!gb->direct.idle_skip || jr_addr >= VRAM_ADDR)
+		return;
+
+	{
+		const uint_fast8_t i = jr_addr % IDLE_LOOP_CACHE_SIZE;
+
+		if(gb->idle.cache[i].jr_addr != jr_addr ||
+				gb->idle.cache[i].bank != bank)
+		{
+			gb->idle.cache[i].jr_addr = jr_addr;
+			gb->idle.cache[i].bank = bank;
+			gb->idle.cache[i].cycles =
+				__gb_idle_loop_cycles(gb, target, jr_addr);
+		}
+
+		loop_cycles = gb->idle.cache[i].cycles;
+	}
+
+	if(loop_cycles == 0)
+		return;
+
+	/* A whole iteration must have run since the JR was last taken, with no
+	 * event in between, so that the registers hold what every following
+	 * iteration will compute. An interrupt that is about to be serviced
+	 * also ends the loop. */
+	if(gb->idle.jr_addr == jr_addr &&
+			gb->counter.cycles == gb->idle.cycles + loop_cycles &&
+			!(gb->gb_ime && (gb->gb_reg.IF & gb->gb_reg.IE & ANY_INTR)))
+	{
+		/* counter.cycles does not yet include this JR. */
+		const uint_fast32_t end = gb->counter.cycles + 12;
+
+		if(end < gb->counter.event_cycles)
+		{
+			gb->counter.cycles += loop_cycles *
+				((gb->counter.event_cycles - end - 1) / loop_cycles);
+		}
+	}
+
+	gb->idle.jr_addr = jr_addr;
+	gb->idle.cycles = gb->counter.cycles;
+}
+#endif
+
+void __gb_step(struct gb_s *gb)
+{
+	__gb_interrupt(gb);
+
+	if(gb->gb_halt)
+	{
+		/* Only an event can raise an interrupt to end HALT, so skip
+		 * straight to the next one in whole 4 cycle steps. */
+		uint_fast32_t halt_cycles = 4;
+
+		if(gb->counter.event_cycles > gb->counter.cycles)
+			halt_cycles = (gb->counter.event_cycles -
+					gb->counter.cycles + 3) & ~3;
+
+		gb->counter.cycles += halt_cycles;
+	}
+	else
+		__gb_run_cpu(gb);
+
+	__gb_run_events(gb);
+	__gb_schedule_events(gb);
+}
+
 void gb_run_frame(struct gb_s *gb)
 {
-    peanut_exec_gb = gb;
 	gb->gb_frame = 0;
+	gb->counter.stop_time = 0;
 	if(gb->display.changed_row_count > 0) {
 		memset(gb->display.changed_rows, 0, sizeof(gb->display.changed_rows));
 	}
 	gb->display.changed_row_count = 0;
 	while(!gb->gb_frame)
 		__gb_step(gb);
-    peanut_exec_gb = NULL;
+}
+
+void gb_run_cycles(struct gb_s *gb, const uint_fast32_t cycles)
+{
+	/* Carry on from where the last call should have stopped, as it may
+	 * have run over. */
+	if(gb->counter.stop_time == 0)
+		gb->counter.stop_time = gb->counter.time;
+
+	gb->counter.stop_time += cycles;
+	__gb_schedule_events(gb);
+
+	while(gb->counter.time < gb->counter.stop_time)
+		__gb_step(gb);
 }
 
 /**
@@ -1151,11 +1879,16 @@ void gb_reset(struct gb_s *gb)
 	gb->cart_ram_bank = 0;
 	gb->enable_cart_ram = 0;
 	gb->cart_mode_select = 0;
+#if PEANUT_GB_DMA_TIMING
+	gb->counter.dma_count = 0;
+#endif
+	__gb_map_pages(gb);
 
 	/* Initialise CPU registers as though a DMG. */
 	gb->cpu_reg.a = 0x01;
+	/* Z and H set. */
 	gb->cpu_reg.nh = 0x10;
-	gb->cpu_reg.z = 1;
+	gb->cpu_reg.z = 0;
 	gb->cpu_reg.cr = 0;
 	gb->cpu_reg.bc = 0x0013;
 	gb->cpu_reg.de = 0x00D8;
@@ -1165,14 +1898,31 @@ void gb_reset(struct gb_s *gb)
 	gb->cpu_reg.pc = 0x0100;
 
 	gb->counter.lcd_count = 0;
-	gb->counter.div_count = 0;
 	gb->counter.tima_count = 0;
 	gb->counter.serial_count = 0;
+	gb->counter.cycles = 0;
+	gb->counter.event_cycles = 0;
+	gb->counter.time = 0;
+	gb->counter.stop_time = 0;
+
+#if PEANUT_GB_IDLE_LOOP_SKIP
+	for(uint_fast8_t i = 0; i < IDLE_LOOP_CACHE_SIZE; i++)
+		gb->idle.cache[i].jr_addr = 0xFFFF;
+
+	gb->idle.jr_addr = 0xFFFF;
+#endif
+
+#if PEANUT_GB_BLOCK_CACHE
+	memset(gb->block_cache.block, 0,
+	       BLOCK_CACHE_SETS * sizeof(*gb->block_cache.block));
+	gb->block_cache.clock = 0;
+#endif
 
 	gb->gb_reg.TIMA      = 0x00;
 	gb->gb_reg.TMA       = 0x00;
 	gb->gb_reg.TAC       = 0xF8;
-	gb->gb_reg.DIV       = 0xAC;
+	/* DIV starts at 0xAC. */
+	gb->counter.div_base = (uint16_t)(0x10000 - 0xAC * DIV_CYCLES);
 
 	gb->gb_reg.IF        = 0xE1;
 
@@ -1197,11 +1947,98 @@ void gb_reset(struct gb_s *gb)
 	gb->gb_reg.P1 = 0xCF;
 
 	memset(gb->vram, 0x00, VRAM_SIZE);
+#if ENABLE_LCD
+	__gb_vram_written(gb, 0, VRAM_SIZE);
+	memset(gb->display.line_drawn, 0, sizeof(gb->display.line_drawn));
+#endif
+	gb->display.sprites_dirty = 1;
+}
+
+void gb_set_rom(struct gb_s *gb, const uint8_t *rom)
+{
+	gb->rom = rom;
+	__gb_map_pages(gb);
+}
+
+void gb_set_cart_ram(struct gb_s *gb, uint8_t *ram)
+{
+	gb->cart_ram_data = ram;
+	__gb_map_pages(gb);
+}
+
+uint8_t gb_cart_ram_modified(const struct gb_s *gb)
+{
+	return gb->cart_ram_dirty;
+}
+
+void gb_cart_ram_clear_modified(struct gb_s *gb)
+{
+	if(!gb->cart_ram_dirty)
+		return;
+
+	gb->cart_ram_dirty = 0;
+	__gb_map_cart_ram(gb);
+}
+
+/**
+ * Buffers that are kept out of struct gb_s, so that they do not push its
+ * frequently used fields apart. Each member is a multiple of
+ * PEANUT_GB_CACHE_LINE in size, so all of them start on a cache line.
+ */
+struct gb_mem_s
+{
+	uint8_t fb[LCD_HEIGHT][LCD_WIDTH / 4];
+#if ENABLE_LCD
+	uint8_t tiles[NUM_TILES][8][8];
+#endif
+#if PEANUT_GB_BLOCK_CACHE
+	struct cpu_block_s block_cache[BLOCK_CACHE_SETS][BLOCK_CACHE_WAYS];
+#endif
+};
+
+/**
+ * Allocate the buffers in struct gb_mem_s, aligned to PEANUT_GB_CACHE_LINE.
+ * malloc() only guarantees the alignment of the largest scalar type, so the
+ * block is over-allocated and the start rounded up.
+ */
+static uint_fast8_t __gb_alloc_mem(struct gb_s *gb)
+{
+	struct gb_mem_s *mem;
+	uintptr_t start;
+
+	gb->mem = malloc(sizeof(struct gb_mem_s) + PEANUT_GB_CACHE_LINE - 1);
+
+	if(gb->mem == NULL)
+		return 0;
+
+	start = ((uintptr_t) gb->mem + PEANUT_GB_CACHE_LINE - 1) &
+		~(uintptr_t) (PEANUT_GB_CACHE_LINE - 1);
+	mem = (struct gb_mem_s *) start;
+	memset(mem, 0, sizeof(struct gb_mem_s));
+
+	gb->display.fb = mem->fb;
+#if ENABLE_LCD
+	gb->display.tiles = mem->tiles;
+#endif
+#if PEANUT_GB_BLOCK_CACHE
+	gb->block_cache.block = mem->block_cache;
+#endif
+
+	return 1;
+}
+
+void gb_free(struct gb_s *gb)
+{
+	free(gb->mem);
+	gb->mem = NULL;
 }
 
 /**
  * Initialise the emulator context. gb_reset() is also called to initialise
- * the CPU.
+ * the CPU. Memory is allocated for the context, which is released by
+ * gb_free(). The context must be zeroed, or released with gb_free(), before
+ * it is initialised: memory held from an earlier gb_init() is not freed here.
+ * gb_free() may be called even if gb_init() fails.
  */
 enum gb_init_error_e gb_init(
 	struct gb_s *gb,
@@ -1242,10 +2079,15 @@ enum gb_init_error_e gb_init(
 	const uint8_t num_ram_banks[] = { 0, 1, 1, 4, 16, 8 };
 
 	gb->gb_rom_read = gb_rom_read;
+	gb->rom = NULL;
+	gb->mem = NULL;
+	gb->cart_ram_data = NULL;
+	gb->cart_ram_dirty = 0;
 	gb->gb_cart_ram_read = gb_cart_ram_read;
 	gb->gb_cart_ram_write = gb_cart_ram_write;
 	gb->gb_error = gb_error;
 	gb->direct.priv = priv;
+	gb->direct.idle_skip = 1;
 
 	/* Initialise serial transfer function to NULL. If the front-end does
 	 * not provide serial support, Peanut-GB will emulate no cable connected
@@ -1273,6 +2115,34 @@ enum gb_init_error_e gb_init(
 			return GB_INIT_CARTRIDGE_UNSUPPORTED;
 	}
 
+	switch(gb->mbc)
+	{
+	case 0:
+		gb->cart_read = __gb_cart_read_mbc0;
+		gb->cart_write = __gb_cart_write_mbc0;
+		break;
+
+	case 1:
+		gb->cart_read = __gb_cart_read_mbc1;
+		gb->cart_write = __gb_cart_write_mbc1;
+		break;
+
+	case 2:
+		gb->cart_read = __gb_cart_read_mbc2;
+		gb->cart_write = __gb_cart_write_mbc2;
+		break;
+
+	case 3:
+		gb->cart_read = __gb_cart_read_mbc3;
+		gb->cart_write = __gb_cart_write_mbc3;
+		break;
+
+	default:
+		gb->cart_read = __gb_cart_read_mbc5;
+		gb->cart_write = __gb_cart_write_mbc5;
+		break;
+	}
+
 	gb->cart_ram = cart_ram[gb->gb_rom_read(gb, mbc_location)];
 	gb->num_rom_banks_mask = num_rom_banks_mask[gb->gb_rom_read(gb, bank_count_location)] - 1;
 	gb->num_ram_banks = num_ram_banks[gb->gb_rom_read(gb, ram_size_location)];
@@ -1280,6 +2150,9 @@ enum gb_init_error_e gb_init(
 	gb->lcd_blank = 0;
 	gb->display.lcd_line_changed = NULL;
 
+	if(!__gb_alloc_mem(gb))
+		return GB_INIT_OUT_OF_MEMORY;
+
 	gb_reset(gb);
 
 	return GB_INIT_NO_ERROR;
@@ -1333,11 +2206,32 @@ void gb_init_lcd(
 	gb->display.window_clear = 0;
 	gb->display.WY = 0;
 	
-	gb->display.back_fb_enabled = 0;
-	
-	memset(gb->display.front_fb, 0, sizeof(gb->display.front_fb));
-	memset(gb->display.back_fb, 0, sizeof(gb->display.back_fb));
+	memset(gb->display.fb, 0, LCD_HEIGHT * LCD_WIDTH / 4);
+	memset(gb->display.line_drawn, 0, sizeof(gb->display.line_drawn));
+
+	gb->display.dither.frame = NULL;
 
 	return;
 }
+
+void gb_set_dither(struct gb_s *gb, uint8_t *frame,
+		const uint_fast16_t stride, const uint_fast8_t x,
+		const uint_fast8_t scale, const uint8_t rows[LCD_HEIGHT][2],
+		const uint8_t patterns[4][4])
+{
+	gb->display.dither.frame = frame;
+	gb->display.dither.stride = stride;
+	gb->display.dither.x = x;
+	gb->display.dither.scale = scale;
+	memcpy(gb->display.dither.rows, rows, sizeof(gb->display.dither.rows));
+
+	for(uint_fast8_t shade = 0; shade < 4; shade++)
+	{
+		for(uint_fast8_t y = 0; y < 4; y++)
+		{
+			const uint8_t p = patterns[shade][y] & 0x0F;
+			gb->display.dither.patterns[y][shade] = (p << 4) | p;
+		}
+	}
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,365 @@
+/**
+ * Host-side tests of cartridge bank switching for each supported MBC.
+ *
+ * Each test builds a synthetic ROM whose banks are tagged with their own
+ * number, switches banks through __gb_write(), and checks what is seen at
+ * 0x4000-0x7FFF both through __gb_read() and through the CPU page table.
+ * Every test is run with ROM and cart RAM read through the callbacks, and
+ * again with them given to the emulator with gb_set_rom() and
+ * gb_set_cart_ram().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peanut_gb.h"
+
+/* Offset within each ROM bank of the bank's number, little endian. */
+#define BANK_TAG	0x2000
+
+struct cart
+{
+	uint8_t *rom;
+	size_t rom_size;
+	uint8_t *ram;
+	size_t ram_size;
+};
+
+static unsigned failures;
+
+#define CHECK(cond, ...)						\
+	do {								\
+		if(!(cond))						\
+		{							\
+			printf("FAIL %s:%d: ", __FILE__, __LINE__);	\
+			printf(__VA_ARGS__);				\
+			printf("\n");					\
+			failures++;					\
+		}							\
+	} while(0)
+
+uint8_t audio_read(struct minigb_apu_ctx *ctx, const uint16_t addr)
+{
+	(void) ctx;
+	(void) addr;
+	return 0xFF;
+}
+
+void audio_write(struct minigb_apu_ctx *ctx, const uint16_t addr,
+		const uint8_t val)
+{
+	(void) ctx;
+	(void) addr;
+	(void) val;
+}
+
+static uint8_t rom_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	const struct cart *c = gb->direct.priv;
+	return addr < c->rom_size ? c->rom[addr] : 0xFF;
+}
+
+static uint8_t cart_ram_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	const struct cart *c = gb->direct.priv;
+	return addr < c->ram_size ? c->ram[addr] : 0xFF;
+}
+
+static void cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,
+		const uint8_t val)
+{
+	const struct cart *c = gb->direct.priv;
+
+	if(addr < c->ram_size)
+		c->ram[addr] = val;
+}
+
+static void error(struct gb_s *gb, const enum gb_error_e err,
+		const uint16_t val)
+{
+	(void) gb;
+	printf("FAIL emulator error %d at %04X\n", err, val);
+	failures++;
+}
+
+/**
+ * Build a ROM of 32 KiB << rom_code bytes with the given cartridge type and
+ * RAM size code in its header.
+ */
+static void cart_create(struct cart *c, const uint8_t type,
+		const uint8_t rom_code, const uint8_t ram_code)
+{
+	const size_t ram_sizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000 };
+	uint8_t x = 0;
+
+	c->rom_size = (size_t) 0x8000 << rom_code;
+	c->rom = calloc(c->rom_size, 1);
+	c->ram_size = ram_sizes[ram_code];
+	c->ram = calloc(c->ram_size ? c->ram_size : 1, 1);
+
+	if(c->rom == NULL || c->ram == NULL)
+	{
+		printf("FAIL out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(size_t bank = 0; bank < c->rom_size / ROM_BANK_SIZE; bank++)
+	{
+		c->rom[bank * ROM_BANK_SIZE + BANK_TAG] = bank & 0xFF;
+		c->rom[bank * ROM_BANK_SIZE + BANK_TAG + 1] = bank >> 8;
+	}
+
+	memcpy(&c->rom[0x134], "MBCTEST", 7);
+	c->rom[0x147] = type;
+	c->rom[0x148] = rom_code;
+	c->rom[0x149] = ram_code;
+
+	for(uint16_t i = 0x134; i <= 0x14C; i++)
+		x = x - c->rom[i] - 1;
+
+	c->rom[ROM_HEADER_CHECKSUM_LOC] = x;
+}
+
+static void cart_destroy(struct cart *c)
+{
+	free(c->rom);
+	free(c->ram);
+}
+
+/* Read addr as the CPU does: through the page table if it is mapped. */
+static uint8_t cpu_read(struct gb_s *gb, const uint_fast16_t addr)
+{
+	const uint8_t *page = gb->read_page[addr >> 12];
+
+	if(page != NULL)
+		return page[addr & 0xFFF];
+
+	return __gb_read(gb, addr);
+}
+
+/* Returns the number of the ROM bank seen at ROM_N_ADDR. */
+static unsigned mapped_bank(struct gb_s *gb)
+{
+	const unsigned bank = __gb_read(gb, ROM_N_ADDR + BANK_TAG) |
+		(__gb_read(gb, ROM_N_ADDR + BANK_TAG + 1) << 8);
+	const unsigned cpu_bank = cpu_read(gb, ROM_N_ADDR + BANK_TAG) |
+		(cpu_read(gb, ROM_N_ADDR + BANK_TAG + 1) << 8);
+
+	CHECK(bank == cpu_bank, "__gb_read sees bank %u, CPU sees bank %u",
+		bank, cpu_bank);
+	return bank;
+}
+
+static void start(struct gb_s *gb, struct cart *c, const int direct)
+{
+	memset(gb, 0, sizeof(*gb));
+
+	if(gb_init(gb, rom_read, cart_ram_read, cart_ram_write, error, c) !=
+			GB_INIT_NO_ERROR)
+	{
+		printf("FAIL gb_init\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(direct)
+	{
+		gb_set_rom(gb, c->rom);
+		gb_set_cart_ram(gb, c->ram);
+	}
+}
+
+#define EXPECT_BANK(gb, expected)					\
+	do {								\
+		const unsigned b = mapped_bank(gb);			\
+		CHECK(b == (expected), "%s: bank %u, expected %u",	\
+			name, b, (unsigned) (expected));		\
+	} while(0)
+
+static void test_mbc1(const int direct)
+{
+	const char *name = direct ? "MBC1 direct" : "MBC1";
+	struct cart c;
+	struct gb_s gb;
+
+	/* MBC1+RAM+BATTERY, 1 MiB ROM, 32 KiB RAM. */
+	cart_create(&c, 0x03, 5, 3);
+	start(&gb, &c, direct);
+
+	EXPECT_BANK(&gb, 1);
+	__gb_write(&gb, 0x2000, 0x1F);
+	EXPECT_BANK(&gb, 0x1F);
+	/* Bank 0 in the low bits selects bank 1 instead. */
+	__gb_write(&gb, 0x2000, 0x00);
+	EXPECT_BANK(&gb, 1);
+	__gb_write(&gb, 0x3FFF, 0x20);
+	EXPECT_BANK(&gb, 1);
+
+	/* Upper two bits from 0x4000-0x5FFF. */
+	__gb_write(&gb, 0x2000, 0x02);
+	__gb_write(&gb, 0x4000, 0x01);
+	EXPECT_BANK(&gb, 0x22);
+
+	/* In mode 1 they select a RAM bank instead. */
+	__gb_write(&gb, 0x6000, 0x01);
+	EXPECT_BANK(&gb, 0x02);
+
+	__gb_write(&gb, 0x0000, 0x0A);
+	__gb_write(&gb, 0xA010, 0x5A);
+	CHECK(c.ram[CRAM_BANK_SIZE + 0x10] == 0x5A,
+		"%s: write to RAM bank 1 went elsewhere", name);
+	CHECK(cpu_read(&gb, 0xA010) == 0x5A && __gb_read(&gb, 0xA010) == 0x5A,
+		"%s: RAM bank 1 read back wrong", name);
+
+	__gb_write(&gb, 0x4000, 0x00);
+	CHECK(cpu_read(&gb, 0xA010) == 0x00,
+		"%s: RAM bank 0 shows bank 1's data", name);
+
+	/* Back in mode 0, the upper bits select the ROM bank again. */
+	__gb_write(&gb, 0x4000, 0x01);
+	__gb_write(&gb, 0x6000, 0x00);
+	EXPECT_BANK(&gb, 0x22);
+
+	/* Disabled RAM reads as 0xFF and ignores writes. */
+	__gb_write(&gb, 0x0000, 0x00);
+	CHECK(cpu_read(&gb, 0xA000) == 0xFF && __gb_read(&gb, 0xA000) == 0xFF,
+		"%s: disabled RAM is readable", name);
+	__gb_write(&gb, 0xA000, 0x77);
+	CHECK(c.ram[0] == 0x00, "%s: disabled RAM was written", name);
+
+	gb_free(&gb);
+	cart_destroy(&c);
+}
+
+static void test_mbc2(const int direct)
+{
+	const char *name = direct ? "MBC2 direct" : "MBC2";
+	struct cart c;
+	struct gb_s gb;
+
+	/* MBC2, 256 KiB ROM. */
+	cart_create(&c, 0x05, 3, 0);
+	start(&gb, &c, direct);
+
+	EXPECT_BANK(&gb, 1);
+	__gb_write(&gb, 0x2110, 0x05);
+	EXPECT_BANK(&gb, 5);
+	__gb_write(&gb, 0x2110, 0x00);
+	EXPECT_BANK(&gb, 1);
+	/* Only four bits are used. */
+	__gb_write(&gb, 0x3F10, 0xFE);
+	EXPECT_BANK(&gb, 0x0E);
+	/* The bank is only selected with address bit 4 set. */
+	__gb_write(&gb, 0x2000, 0x03);
+	EXPECT_BANK(&gb, 0x0E);
+
+	gb_free(&gb);
+	cart_destroy(&c);
+}
+
+static void test_mbc3(const int direct)
+{
+	const char *name = direct ? "MBC3 direct" : "MBC3";
+	struct cart c;
+	struct gb_s gb;
+
+	/* MBC3+RAM+BATTERY, 2 MiB ROM, 32 KiB RAM. */
+	cart_create(&c, 0x13, 6, 3);
+	start(&gb, &c, direct);
+
+	EXPECT_BANK(&gb, 1);
+	__gb_write(&gb, 0x2000, 0x7F);
+	EXPECT_BANK(&gb, 0x7F);
+	__gb_write(&gb, 0x2000, 0x00);
+	EXPECT_BANK(&gb, 1);
+	/* All seven bits select the bank, unlike MBC1. */
+	__gb_write(&gb, 0x3000, 0x20);
+	EXPECT_BANK(&gb, 0x20);
+	__gb_write(&gb, 0x2000, 0xC5);
+	EXPECT_BANK(&gb, 0x45);
+
+	__gb_write(&gb, 0x0000, 0x0A);
+	__gb_write(&gb, 0xA123, 0x3C);
+	CHECK(c.ram[0x123] == 0x3C, "%s: RAM write went elsewhere", name);
+	CHECK(cpu_read(&gb, 0xA123) == 0x3C && __gb_read(&gb, 0xA123) == 0x3C,
+		"%s: RAM read back wrong", name);
+
+	__gb_write(&gb, 0x0000, 0x00);
+	CHECK(cpu_read(&gb, 0xA123) == 0xFF, "%s: disabled RAM is readable",
+		name);
+
+	gb_free(&gb);
+	cart_destroy(&c);
+}
+
+static void test_mbc5(const int direct)
+{
+	const char *name = direct ? "MBC5 direct" : "MBC5";
+	struct cart c;
+	struct gb_s gb;
+
+	/* MBC5+RAM+BATTERY, 8 MiB ROM, 32 KiB RAM. */
+	cart_create(&c, 0x1B, 8, 3);
+	start(&gb, &c, direct);
+
+	EXPECT_BANK(&gb, 1);
+	__gb_write(&gb, 0x2000, 0x34);
+	EXPECT_BANK(&gb, 0x34);
+	/* The ninth bit is written separately. */
+	__gb_write(&gb, 0x3000, 0x01);
+	EXPECT_BANK(&gb, 0x134);
+	__gb_write(&gb, 0x2000, 0xFF);
+	EXPECT_BANK(&gb, 0x1FF);
+	/* Bank 0 can be selected. */
+	__gb_write(&gb, 0x3000, 0x00);
+	__gb_write(&gb, 0x2000, 0x00);
+	EXPECT_BANK(&gb, 0);
+
+	__gb_write(&gb, 0x0000, 0x0A);
+	__gb_write(&gb, 0xBFFF, 0xA5);
+	CHECK(c.ram[0x1FFF] == 0xA5, "%s: RAM write went elsewhere", name);
+	CHECK(cpu_read(&gb, 0xBFFF) == 0xA5 && __gb_read(&gb, 0xBFFF) == 0xA5,
+		"%s: RAM read back wrong", name);
+
+	gb_free(&gb);
+	cart_destroy(&c);
+}
+
+static void test_rom_only(const int direct)
+{
+	const char *name = direct ? "ROM only direct" : "ROM only";
+	struct cart c;
+	struct gb_s gb;
+
+	cart_create(&c, 0x00, 0, 0);
+	start(&gb, &c, direct);
+
+	EXPECT_BANK(&gb, 1);
+	/* Writes to the MBC registers are ignored. */
+	__gb_write(&gb, 0x2000, 0x00);
+	EXPECT_BANK(&gb, 1);
+
+	gb_free(&gb);
+	cart_destroy(&c);
+}
+
+int main(void)
+{
+	for(int direct = 0; direct <= 1; direct++)
+	{
+		test_rom_only(direct);
+		test_mbc1(direct);
+		test_mbc2(direct);
+		test_mbc3(direct);
+		test_mbc5(direct);
+	}
+
+	if(failures)
+	{
+		printf("%u check(s) failed\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("All MBC tests passed\n");
+	return EXIT_SUCCESS;
+}